@@ -0,0 +1,670 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <chrono>
+#include <random>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#endif
+#include "hough_transform.h"
+#include "fast_hough_transform.h"
+#include "radon_transform.h"
+#include "static_hough_transform.h"
+#include "heavy_hitter_space.h"
+#include "out_of_core_space.h"
+#include "space_file.h"
+#include "utils.h"
+
+// heap allocations so far, counted by the replaced global operator new, every form of new
+// and delete is replaced so they stay paired
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *p = std::malloc(size)) return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+// kept out of line: GCC flags free inlined on memory from operator new as a mismatch
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete[](void *p) noexcept { operator delete(p); }
+
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+
+void operator delete[](void *p, size_t) noexcept { operator delete(p); }
+
+namespace {
+  template <typename F>
+  double measureMs(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+  }
+
+  template <typename F>
+  auto timed(F f, double &ms) -> decltype(f()) {
+    auto start = std::chrono::steady_clock::now();
+    auto result = f();
+    ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return result;
+  }
+
+  // resident memory of the process in MiB from /proc, negative when unavailable
+  double residentMiB() {
+    std::ifstream statm("/proc/self/statm");
+    size_t total = 0, resident = 0;
+    if (!(statm >> total >> resident)) return -1;
+    return static_cast<double>(resident) * sysconf(_SC_PAGESIZE) / (1 << 20);
+  }
+
+  /*
+   * Resets the peak resident memory of the process to its current resident memory
+   * (clear_refs 5, Linux 4.0 and later), false when it cannot be reset
+  */
+  bool resetPeakResident() {
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5" << std::flush;
+    return clearRefs.good();
+  }
+
+  // peak resident memory of the process in MiB since the last reset from /proc, negative
+  // when unavailable
+  double peakResidentMiB() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+      if (line.compare(0, 6, "VmHWM:") == 0) return std::atof(line.c_str() + 6) / 1024;
+    }
+    return -1;
+  }
+
+  // peak of f over the resident memory before it in MiB, negative when unavailable
+  template <typename F>
+  double peakGrowthMiB(F f) {
+    if (!resetPeakResident()) {
+      f();
+      return -1;
+    }
+    double before = peakResidentMiB();
+    f();
+    return peakResidentMiB() - before;
+  }
+
+  /*
+   * Data TLB load misses of the calling thread while f runs, negative when the counter is
+   * not available (no perf events, restricted by perf_event_paranoid or virtualized)
+  */
+  template <typename F>
+  double dtlbMisses(F f) {
+#ifdef __linux__
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      f();
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      uint64_t misses = 0;
+      bool read = ::read(fd, &misses, sizeof(misses)) == sizeof(misses);
+      close(fd);
+      return read ? static_cast<double>(misses) : -1;
+    }
+#endif
+    f();
+    return -1;
+  }
+
+  Image<uint8_t> denseImage(size_t n, double density, unsigned seed) {
+    Image<uint8_t> image(n, n);
+    std::mt19937 gen(seed);
+    std::bernoulli_distribution dis(density);
+    for (auto &p : image.pixels) p = dis(gen) ? 1 : 0;
+    for (size_t x = 0; x < n; ++x) image.at(x, (x / 3 + n / 4) % n) = 1;
+    return image;
+  }
+
+  template <typename T>
+  std::vector<Point<double>> imagePoints(const Image<T> &image) {
+    std::vector<Point<double>> points;
+    for (size_t y = 0; y < image.height; ++y) {
+      for (size_t x = 0; x < image.width; ++x) {
+        if (image.at(x, y) != T()) points.emplace_back(x, y);
+      }
+    }
+    return points;
+  }
+
+  // the order of magnitude is the target for dense images (density 0.3), 0.1 shows where it fades
+  void fastHoughVsVoting() {
+    std::cout << "== Fast Hough Transform vs point voting (rStep 1, thetaStep 0.005) ==" << std::endl;
+    for (size_t n : {128, 256, 512}) {
+      for (double density : {0.1, 0.3}) {
+        auto image = denseImage(n, density, 1);
+        auto points = imagePoints(image);
+        HoughTransformer2d<double, double> voting(1, 0.005);
+        FastHoughTransformer<double, double> fast(1, 0.005);
+        double tVote = measureMs([&]() { voting.transform(points); });
+        double tFast = measureMs([&]() { fast.transform(image); });
+        std::cout << n << "x" << n << " density " << density << ": voting " << tVote
+                  << " ms, fht " << tFast << " ms, speedup " << tVote / tFast << std::endl;
+      }
+    }
+  }
+
+  void radonVsWeightedVoting() {
+    std::cout << "== Radon (Fourier slice) vs weighted voting (rStep 1, thetaStep 0.01) ==" << std::endl;
+    for (size_t n : {64, 128, 256}) {
+      Image<uint8_t> image(n, n);
+      std::mt19937 gen(2);
+      std::uniform_int_distribution<int> noise(0, 40);
+      for (auto &p : image.pixels) p = static_cast<uint8_t>(noise(gen));
+      for (size_t x = 0; x < n; ++x) image.at(x, (x * 2 / 5 + n / 5) % n) = 220;
+      std::vector<Point<double>> points;
+      std::vector<uint32_t> weights;
+      for (size_t y = 0; y < n; ++y) {
+        for (size_t x = 0; x < n; ++x) {
+          points.emplace_back(x, y);
+          weights.push_back(image.at(x, y));
+        }
+      }
+      HoughTransformer2d<double, double> voting(1, 0.01);
+      RadonTransformer<double, double> radon(1, 0.01);
+      double tVote = 0, tRadon = 0;
+      auto exact = timed([&]() { return voting.transform(points, weights); }, tVote);
+      auto approx = timed([&]() { return radon.transform(image); }, tRadon);
+      auto a = exact.getSpace(), b = approx.getSpace();
+      double diff = 0, total = 0;
+      for (size_t i = 0; i < a.size(); ++i) {
+        for (size_t j = 0; j < a[i].size(); ++j) {
+          diff += std::abs(static_cast<double>(a[i][j]) - static_cast<double>(b[i][j]));
+          total += a[i][j];
+        }
+      }
+      auto la = exact.getLines(1)[0], lb = approx.getLines(1)[0];
+      std::cout << n << "x" << n << ": voting " << tVote << " ms, radon " << tRadon
+                << " ms, speedup " << tVote / tRadon << ", relative L1 error " << diff / total
+                << ", peak delta r " << lb.r - la.r << " theta " << lb.theta - la.theta << std::endl;
+    }
+  }
+
+  void earlyTermination() {
+    std::cout << "== Early termination for getLines(k) (rStep 1, thetaStep 0.01) ==" << std::endl;
+    std::mt19937 gen(4);
+    std::uniform_real_distribution<double> dis(-200, 200);
+    std::vector<Point<double>> points;
+    for (int i = 0; i < 5000; ++i) points.emplace_back(dis(gen), dis(gen));
+    for (int l = 0; l < 4; ++l) {
+      for (int i = 0; i < 10000 / (l + 1); ++i) {
+        double x = dis(gen);
+        points.emplace_back(x, (l - 1.5) * x + 20 * l);
+      }
+    }
+    HoughTransformer2d<double, double> transformer(1, 0.01);
+    double tFull = measureMs([&]() { transformer.transform(points); });
+    for (size_t k : {1, 2, 4}) {
+      double tTop = 0;
+      auto result = timed([&]() { return transformer.transformTop(points, k); }, tTop);
+      std::cout << "k " << k << ": full " << tFull << " ms, early " << tTop << " ms, voted "
+                << result.voted << " of " << points.size() << ", speedup " << tFull / tTop
+                << std::endl;
+    }
+  }
+
+  void pointOrder() {
+    std::cout << "== Space-filling curve point order (rStep 0.05, thetaStep 0.005) ==" << std::endl;
+    std::mt19937 gen(6);
+    std::uniform_real_distribution<float> dis(-500, 500);
+    std::vector<Point<float>> points;
+    for (int i = 0; i < 20000; ++i) points.emplace_back(dis(gen), dis(gen));
+    HoughTransformer2d<float, float> transformer(0.05, 0.005);
+    const char *names[] = {"input", "morton", "hilbert"};
+    PointOrder orders[] = {PointOrder::Input, PointOrder::Morton, PointOrder::Hilbert};
+    for (size_t i = 0; i < 3; ++i) {
+      double tSort = measureMs([&]() { curveOrder(points, orders[i]); });
+      transformer.setPointOrder(orders[i]);
+      double tVote = measureMs([&]() { transformer.transform(points); });
+      std::cout << names[i] << ": sort " << tSort << " ms, transform " << tVote << " ms"
+                << std::endl;
+    }
+  }
+
+  template <typename R_T, typename THETA_T>
+  void precisionCase(const char *name, size_t amount) {
+    std::mt19937 gen(8);
+    std::uniform_real_distribution<R_T> dis(-100, 100);
+    std::vector<Point<R_T>> points;
+    for (size_t i = 0; i < amount; ++i) points.emplace_back(dis(gen), dis(gen));
+    HoughTransformer2d<R_T, THETA_T> transformer(static_cast<R_T>(0.05), static_cast<THETA_T>(0.002));
+    double t = measureMs([&]() { transformer.transform(points); });
+    std::cout << name << ": " << t << " ms" << std::endl;
+  }
+
+  void precision() {
+    std::cout << "== Type combinations, 20000 points (rStep 0.05, thetaStep 0.002) ==" << std::endl;
+    precisionCase<float, float>("<float, float>", 20000);
+    precisionCase<float, double>("<float, double>", 20000);
+    precisionCase<float, long double>("<float, long double>", 20000);
+    precisionCase<double, float>("<double, float>", 20000);
+    precisionCase<double, double>("<double, double>", 20000);
+    precisionCase<double, long double>("<double, long double>", 20000);
+  }
+
+  void staticGrid() {
+    std::cout << "== Compile-time grid, 0.5 degree over 2048 px frame, 20000 points ==" << std::endl;
+    std::mt19937 gen(9);
+    std::uniform_real_distribution<float> dis(0, 2048);
+    std::vector<Point<float>> points;
+    for (int i = 0; i < 20000; ++i) points.emplace_back(dis(gen), dis(gen));
+    HoughTransformer2d<float, float> dynamic(1, static_cast<float>(2 * STATIC_PI / 720));
+    StaticHoughTransformer2d<float, 720, 2897, 2897> fixed;
+    double tDynamic = measureMs([&]() { dynamic.transform(points); });
+    double tStatic = measureMs([&]() { fixed.transform(points); });
+    std::cout << "runtime grid " << tDynamic << " ms, compile-time grid " << tStatic << " ms"
+              << std::endl;
+  }
+
+  void sparseStorage() {
+    std::cout << "== Sparse vs dense accumulator, lidar-like scan (rStep 0.01, thetaStep 0.01) ==" << std::endl;
+    std::mt19937 gen(10);
+    std::uniform_real_distribution<double> dis(0, 1000);
+    for (int amount : {500, 2000, 8000}) {
+      std::vector<Point<double>> points;
+      for (int i = 0; i < amount; ++i) {
+        double x = dis(gen);
+        points.emplace_back(x, i % 2 ? 0.3 * x + 100 : 800 - 0.5 * x);
+      }
+      HoughTransformer2d<double, double> transformer(0.01, 0.01);
+      double tDense = 0, tSparse = 0;
+      auto dense = timed([&]() {
+        return transformer.setStorage(SpaceStorage::Dense).transform(points).getLines(2); }, tDense);
+      auto sparse = timed([&]() {
+        return transformer.setStorage(SpaceStorage::Sparse).transform(points).getLines(2); }, tSparse);
+      std::cout << amount << " points: dense " << tDense << " ms, sparse " << tSparse
+                << " ms, same lines " << (dense[0].r == sparse[0].r && dense[1].r == sparse[1].r)
+                << std::endl;
+    }
+  }
+
+  void heavyHitters() {
+    std::cout << "== Heavy-hitter stream summary vs exact space (rStep 0.5, thetaStep 0.02) ==" << std::endl;
+    std::mt19937 gen(11);
+    std::uniform_real_distribution<double> dis(0, 500);
+    std::vector<Point<double>> points;
+    for (int i = 0; i < 50000; ++i) {
+      points.emplace_back(dis(gen), dis(gen));
+      if (i % 10 == 0) points.emplace_back(i * 0.01, 0.5 * i * 0.01 + 40);
+    }
+    HoughTransformer2d<double, double> transformer(0.5, 0.02);
+    double tExact = 0;
+    auto exact = timed([&]() { return transformer.transform(points); }, tExact);
+    auto exactTop = exact.getLines(1)[0];
+    for (size_t capacity : {1000, 10000}) {
+      HeavyHitterSpace<double, double> stream(0.5, 0.02, capacity);
+      double tStream = measureMs([&]() { stream.add(points); });
+      auto top = stream.getLines(1)[0];
+      std::cout << "capacity " << capacity << ": exact " << tExact << " ms, stream " << tStream
+                << " ms, max error " << stream.maxError() << " of " << stream.votes()
+                << " votes, top count " << exact.get(top.r, top.theta) << " (exact top "
+                << exact.get(exactTop.r, exactTop.theta) << ")" << std::endl;
+    }
+  }
+
+  void layouts() {
+    std::cout << "== Accumulator layout, 20000 points (rStep 0.05, thetaStep 0.005) ==" << std::endl;
+    std::mt19937 gen(12);
+    std::uniform_real_distribution<float> dis(-500, 500);
+    std::vector<Point<float>> points;
+    for (int i = 0; i < 20000; ++i) points.emplace_back(dis(gen), dis(gen));
+    HoughTransformer2d<float, float> transformer(0.05, 0.005);
+    const char *names[] = {"row-major", "column-major", "tiled"};
+    Layout kinds[] = {Layout::RowMajor, Layout::ColumnMajor, Layout::Tiled};
+    for (size_t i = 0; i < 3; ++i) {
+      transformer.setLayout(kinds[i]);
+      for (PointOrder order : {PointOrder::Input, PointOrder::Hilbert}) {
+        transformer.setPointOrder(order);
+        double tLines = 0;
+        double tVote = measureMs([&]() {
+          auto space = transformer.transform(points);
+          tLines = measureMs([&]() { space.getLines(10); });
+        });
+        std::cout << names[i] << (order == PointOrder::Input ? ", input order" : ", hilbert order")
+                  << ": transform " << tVote - tLines << " ms, getLines " << tLines << " ms"
+                  << std::endl;
+      }
+    }
+  }
+
+  void counterWidths() {
+    std::cout << "== Counter width, 20000 points (rStep 0.05, thetaStep 0.005) ==" << std::endl;
+    std::mt19937 gen(13);
+    std::uniform_real_distribution<float> dis(-500, 500);
+    std::vector<Point<float>> points;
+    for (int i = 0; i < 20000; ++i) points.emplace_back(dis(gen), dis(gen));
+    HoughTransformer2d<float, float> transformer(0.05, 0.005);
+    transformer.setPointOrder(PointOrder::Hilbert);
+    for (unsigned width : {4, 2}) {
+      transformer.setCounterWidth(width);
+      double tLines = 0;
+      double tVote = measureMs([&]() {
+        auto space = transformer.transform(points);
+        tLines = measureMs([&]() { space.getLines(10); });
+      });
+      std::cout << width * 8 << " bit: transform " << tVote - tLines << " ms, getLines " << tLines
+                << " ms" << std::endl;
+    }
+  }
+
+  void hugePages() {
+    std::cout << "== Huge pages, 20000 points (rStep 0.05, thetaStep 0.002, 16 bit) ==" << std::endl;
+    std::mt19937 gen(19);
+    std::uniform_real_distribution<float> dis(-500, 500);
+    std::vector<Point<float>> points;
+    for (int i = 0; i < 20000; ++i) points.emplace_back(dis(gen), dis(gen));
+    HoughTransformer2d<float, float> transformer(0.05, 0.002);
+    transformer.setStorage(SpaceStorage::Dense);
+    for (bool huge : {false, true}) {
+      transformer.setHugePages(huge);
+      double tVote = 0;
+      double misses = dtlbMisses([&]() {
+        tVote = measureMs([&]() { transformer.transform(points); });
+      });
+      std::cout << (huge ? "huge" : "regular") << " pages: transform " << tVote
+                << " ms, dTLB misses ";
+      if (misses < 0) {
+        std::cout << "n/a" << std::endl;
+      } else {
+        std::cout << misses << std::endl;
+      }
+    }
+  }
+
+  void outOfCore() {
+    std::cout << "== Out-of-core space, 2000 points (rStep 0.05, thetaStep 0.002, 16 MiB slabs) =="
+              << std::endl;
+    std::mt19937 gen(23);
+    std::uniform_real_distribution<float> dis(-500, 500);
+    std::vector<Point<float>> points;
+    for (int i = 0; i < 2000; ++i) points.emplace_back(dis(gen), dis(gen));
+    // the peak is reset before each mode, so neither sees the other or earlier benchmarks
+    double tVote = 0, tLines = 0;
+    double peak = peakGrowthMiB([&]() {
+      tVote = measureMs([&]() {
+        OutOfCoreHoughSpace<float, float> space(0.05, 0.002, 16 << 20);
+        if (!space.transform(points, "out_of_core_benchmark.bin")) return;
+        tLines = measureMs([&]() { space.getLines(10); });
+        std::cout << space.slabs() << " slabs: ";
+      });
+    });
+    std::remove("out_of_core_benchmark.bin");
+    std::cout << "transform " << tVote - tLines << " ms, getLines " << tLines << " ms, peak +"
+              << peak << " MiB" << std::endl;
+    peak = peakGrowthMiB([&]() {
+      tVote = measureMs([&]() {
+        auto space = HoughTransformer2d<float, float>(0.05, 0.002).transform(points);
+        tLines = measureMs([&]() { space.getLines(10); });
+      });
+    });
+    std::cout << "in memory: transform " << tVote - tLines << " ms, getLines " << tLines
+              << " ms, peak +" << peak << " MiB" << std::endl;
+  }
+
+  void reusedSpace() {
+    std::cout << "== Reused space, 30 frames of 2000 points (rStep 0.5, thetaStep 0.005) =="
+              << std::endl;
+    std::mt19937 gen(29);
+    std::uniform_real_distribution<float> dis(-400, 400);
+    std::vector<std::vector<Point<float>>> frames(30);
+    for (auto &frame : frames) {
+      for (int i = 0; i < 2000; ++i) frame.emplace_back(dis(gen), dis(gen));
+    }
+    HoughTransformer2d<float, float> transformer(0.5, 0.005);
+    size_t before = allocations;
+    double tFresh = measureMs([&]() {
+      for (const auto &frame : frames) transformer.transform(frame);
+    });
+    size_t fresh = allocations - before;
+    auto space = transformer.transform(frames[0]);
+    before = allocations;
+    double tReused = measureMs([&]() {
+      for (const auto &frame : frames) transformer.transformInto(frame, space);
+    });
+    size_t reused = allocations - before;
+    std::cout << "transform: " << tFresh / frames.size() << " ms/frame, "
+              << static_cast<double>(fresh) / frames.size() << " allocations/frame" << std::endl;
+    std::cout << "transformInto: " << tReused / frames.size() << " ms/frame, "
+              << static_cast<double>(reused) / frames.size() << " allocations/frame" << std::endl;
+  }
+
+  void arena() {
+    std::cout << "== Monotonic arena, 30 frames of 2000 points (rStep 0.5, thetaStep 0.005), "
+                 "getLines(100000) ==" << std::endl;
+    std::mt19937 gen(31);
+    std::uniform_real_distribution<float> dis(-400, 400);
+    std::vector<std::vector<Point<float>>> frames(30);
+    for (auto &frame : frames) {
+      for (int i = 0; i < 2000; ++i) frame.emplace_back(dis(gen), dis(gen));
+    }
+    HoughTransformer2d<float, float> transformer(0.5, 0.005);
+    MonotonicArena frameArena;
+    for (bool useArena : {false, true}) {
+      transformer.setMemoryResource(useArena ? &frameArena : nullptr);
+      double t = measureMs([&]() {
+        for (const auto &frame : frames) {
+          transformer.transform(frame).getLines(100000);
+          frameArena.release();
+        }
+      });
+      std::cout << (useArena ? "arena" : "heap") << ": " << t / frames.size() << " ms/frame";
+      if (useArena) std::cout << ", arena of " << frameArena.capacity() / 1024 << " KiB";
+      std::cout << std::endl;
+    }
+  }
+
+  void spaceView() {
+    std::cout << "== Reading the space, 20000 points (rStep 0.05, thetaStep 0.002, 16 bit) =="
+              << std::endl;
+    std::mt19937 gen(37);
+    std::uniform_real_distribution<float> dis(-500, 500);
+    std::vector<Point<float>> points;
+    for (int i = 0; i < 20000; ++i) points.emplace_back(dis(gen), dis(gen));
+    auto space = HoughTransformer2d<float, float>(0.05, 0.002).transform(points);
+    uint64_t copied = 0, viewed = 0;
+    double tCopy = measureMs([&]() {
+      for (const auto &row : space.getSpace()) {
+        for (uint32_t c : row) copied += c;
+      }
+    });
+    double tView = measureMs([&]() {
+      auto view = space.view<uint16_t>();
+      for (size_t i = 0; i < view.rows; ++i) {
+        const uint16_t *row = view.data + i * view.rowStride;
+        for (size_t j = 0; j < view.columns; ++j) viewed += row[j];
+      }
+    });
+    std::cout << "getSpace " << tCopy << " ms, view " << tView << " ms"
+              << (copied == viewed ? "" : ", sums differ") << std::endl;
+  }
+
+  void spaceFile() {
+    std::cout << "== Saved space, 20000 points (rStep 0.1, thetaStep 0.002, 16 bit) =="
+              << std::endl;
+    std::mt19937 gen(41);
+    std::uniform_real_distribution<float> dis(-500, 500);
+    std::vector<Point<float>> points;
+    for (int i = 0; i < 20000; ++i) points.emplace_back(dis(gen), dis(gen));
+    auto space = HoughTransformer2d<float, float>(0.1, 0.002).transform(points);
+    using file_t = SpaceFile<float, float>;
+    const char *path = "space_file_benchmark.bin", *text = "space_file_benchmark.txt";
+    double tText = measureMs([&]() {
+      std::ofstream out(text);
+      for (const auto &row : space.getSpace()) {
+        for (uint32_t c : row) out << c << ' ';
+        out << '\n';
+      }
+    });
+    std::ifstream textFile(text, std::ios::ate);
+    std::cout << "text dump " << tText << " ms, " << (textFile.tellg() >> 20) << " MiB"
+              << std::endl;
+    std::remove(text);
+    double tSave = measureMs([&]() { file_t::save(space, path); });
+    std::ifstream binaryFile(path, std::ios::ate);
+    std::cout << "save " << tSave << " ms, " << (binaryFile.tellg() >> 20) << " MiB" << std::endl;
+    std::unique_ptr<HoughSpace<float, float>> stored;
+    for (bool mapped : {false, true}) {
+      double tLines = 0;
+      double tOpen = measureMs([&]() {
+        if (!(mapped ? file_t::open(path, stored) : file_t::load(path, stored))) return;
+        tLines = measureMs([&]() { stored->getLines(10); });
+      });
+      std::cout << (mapped ? "open " : "load ") << tOpen - tLines << " ms, then getLines "
+                << tLines << " ms" << std::endl;
+      stored.reset();
+    }
+    tSave = measureMs([&]() { file_t::save(space, path, SpaceEncoding::Compressed); });
+    std::ifstream compressedFile(path, std::ios::ate);
+    double tLoad = measureMs([&]() { file_t::load(path, stored); });
+    std::cout << "compressed: save " << tSave << " ms, " << (compressedFile.tellg() >> 10)
+              << " KiB, load " << tLoad << " ms" << std::endl;
+    std::remove(path);
+    // the codec alone against a copy of the counters, on this space and on a sparse one
+    for (size_t voted : {points.size(), size_t(500)}) {
+      std::vector<Point<float>> some(points.begin(), points.begin() + voted);
+      auto counted = HoughTransformer2d<float, float>(0.1, 0.002).setCounterWidth(2)
+                       .setStorage(SpaceStorage::Dense).transform(some);
+      auto view = counted.view<uint16_t>();
+      size_t n = view.rows * view.columns;
+      std::vector<uint16_t> copy(n);
+      std::vector<uint8_t> code;
+      double tCopy = measureMs([&]() { std::memcpy(copy.data(), view.data, n * 2); });
+      double tEncode = measureMs([&]() { SpaceCodec::encode(view.data, n, view.columns, code); });
+      double tDecode = measureMs([&]() {
+        SpaceCodec::decode(code.data(), code.size(), copy.data(), n, view.columns);
+      });
+      std::cout << voted << " points: memcpy " << tCopy << " ms, encode " << tEncode
+                << " ms, decode " << tDecode << " ms, " << 100.0 * code.size() / (n * 2)
+                << "% of raw" << std::endl;
+    }
+  }
+
+  void mergedShards() {
+    std::cout << "== Merged shards, 4 x 5000 points (rStep 0.1, thetaStep 0.002) =="
+              << std::endl;
+    std::mt19937 gen(43);
+    std::uniform_real_distribution<float> dis(-500, 500);
+    std::vector<Point<float>> points;
+    for (int i = 0; i < 20000; ++i) points.emplace_back(dis(gen), dis(gen));
+    float maxR = 0;
+    for (const auto &p : points) maxR = std::max(maxR, std::sqrt(p.x * p.x + p.y * p.y));
+    HoughTransformer2d<float, float> transformer(0.1, 0.002);
+    transformer.setMaxR(maxR).setCounterWidth(2);
+    double tWhole = measureMs([&]() { transformer.transform(points); });
+    std::vector<HoughSpace<float, float>> shards;
+    double tShards = measureMs([&]() {
+      for (size_t s = 0; s != 4; ++s) {
+        std::vector<Point<float>> shard(points.begin() + s * 5000, points.begin() + (s + 1) * 5000);
+        shards.push_back(transformer.transform(shard));
+      }
+    });
+    auto column = transformer.setLayout(Layout::ColumnMajor).setStorage(SpaceStorage::Dense)
+                             .transform(std::vector<Point<float>>());
+    double tMerge = measureMs([&]() {
+      for (size_t s = 1; s != 4; ++s) shards[0] += shards[s];
+    });
+    // a space of another layout is merged a square of cells at a time, here transposing
+    double tCells = measureMs([&]() { column += shards[0]; });
+    std::cout << "whole " << tWhole << " ms, shards " << tShards << " ms, 3 merges " << tMerge
+              << " ms (" << tMerge / 3 << " ms each), row-major into column-major " << tCells
+              << " ms"
+              << (column.getSpace() == transformer.transform(points).getSpace() ? ""
+                                                                              : ", sums differ")
+              << std::endl;
+  }
+
+  void removedPoints() {
+    std::cout << "== Retracting 100 of 20000 points (rStep 0.1, thetaStep 0.002) ==" << std::endl;
+    std::mt19937 gen(47);
+    std::uniform_real_distribution<float> dis(-500, 500);
+    std::vector<Point<float>> points;
+    for (int i = 0; i < 20000; ++i) points.emplace_back(dis(gen), dis(gen));
+    std::vector<Point<float>> rest(points.begin(), points.end() - 100),
+                              retracted(points.end() - 100, points.end());
+    HoughTransformer2d<float, float> transformer(0.1, 0.002);
+    auto space = transformer.transform(points);
+    double tTransform = measureMs([&]() { transformer.transform(rest); });
+    bool removed = false, added = false;
+    double tRemove = measureMs([&]() { removed = space.removePoints(retracted); });
+    double tAdd = measureMs([&]() { added = space.addPoints(retracted); });
+    std::cout << "transform of the rest " << tTransform << " ms, removePoints " << tRemove << " ms"
+              << (removed ? "" : ", not removed") << ", addPoints " << tAdd << " ms"
+              << (added ? "" : ", not added") << std::endl;
+  }
+
+  void lazyPages() {
+    std::cout << "== Lazy pages, 200 clustered points far from origin (rStep 0.1, thetaStep 0.005, "
+                 "column-major) ==" << std::endl;
+    std::mt19937 gen(17);
+    std::uniform_real_distribution<float> dis(-2, 2);
+    std::vector<Point<float>> points;
+    for (int i = 0; i < 200; ++i) points.emplace_back(7000 + dis(gen), 7000 + dis(gen));
+    HoughTransformer2d<float, float> transformer(0.1, 0.005);
+    transformer.setStorage(SpaceStorage::Dense).setLayout(Layout::ColumnMajor);
+    for (bool lazy : {false, true}) {
+      transformer.setLazyPages(lazy);
+      double before = residentMiB(), tLines = 0, resident = 0;
+      double tVote = measureMs([&]() {
+        auto space = transformer.transform(points);
+        resident = residentMiB() - before;
+        tLines = measureMs([&]() { space.getLines(10); });
+      });
+      std::cout << (lazy ? "lazy" : "eager") << ": transform " << tVote - tLines << " ms, getLines "
+                << tLines << " ms, resident +" << resident << " MiB" << std::endl;
+    }
+  }
+}
+
+/*
+ * Runs every benchmark and prints timings on stdout.
+*/
+int main() {
+  fastHoughVsVoting();
+  radonVsWeightedVoting();
+  earlyTermination();
+  pointOrder();
+  precision();
+  staticGrid();
+  sparseStorage();
+  heavyHitters();
+  layouts();
+  counterWidths();
+  lazyPages();
+  hugePages();
+  outOfCore();
+  reusedSpace();
+  arena();
+  spaceView();
+  spaceFile();
+  mergedShards();
+  removedPoints();
+  return 0;
+}
@@ -1,7 +1,16 @@
 #include <gtest.h>
 #include "hough_transform.h"
+#include "fast_hough_transform.h"
+#include "radon_transform.h"
+#include "static_hough_transform.h"
+#include "heavy_hitter_space.h"
+#include "out_of_core_space.h"
+#include "space_file.h"
+#include "space_codec.h"
 #include "utils.h"
 #include <random>
+#include <cstdio>
+#include <iterator>
 
 namespace {
   template <typename T1, typename T2>
@@ -122,3 +131,820 @@ TEST(Points10000, randomPointsDestribution) {
   auto lines = hs.getLines(1000000000);
   checkEachLine(lines, points, hs);
 }
+
+TEST(fastHough, verticalSegment) {
+  Image<uint8_t> image(64, 64);
+  for (size_t y = 5; y < 55; ++y) image.at(20, y) = 1;
+  FastHoughTransformer<double, double> transformer(1, 0.01);
+  auto hs = transformer.transform(image);
+  auto lines = hs.getLines(1);
+  ASSERT_EQ(1u, lines.size());
+  EXPECT_EQ(50u, hs.get(lines[0].r, lines[0].theta));
+  EXPECT_NEAR(20, lines[0].r, 1);
+  EXPECT_NEAR(0, lines[0].theta, 0.02);
+}
+
+TEST(fastHough, slopedLineInNoise) {
+  Image<uint8_t> image(128, 128);
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<size_t> dis(0, 127);
+  for (int i = 0; i < 300; ++i) image.at(dis(gen), dis(gen)) = 1;
+  for (size_t x = 0; x < 128; ++x) image.at(x, static_cast<size_t>(std::lround(x * 0.5 + 10))) = 1;
+  FastHoughTransformer<double, double> transformer(1, 0.01);
+  auto hs = transformer.transform(image);
+  auto lines = hs.getLines(1);
+  ASSERT_EQ(1u, lines.size());
+  EXPECT_LE(110u, hs.get(lines[0].r, lines[0].theta));
+  EXPECT_NEAR(std::atan2(2.0, -1.0), lines[0].theta, 0.03);
+  EXPECT_NEAR(20 / std::sqrt(5.0), lines[0].r, 1.5);
+}
+
+TEST(weightedVoting, unitWeights) {
+  std::vector<Point<double>> points = {{0, 0.66}, {-1, 0}, {2, 2}, {3, -1}};
+  HoughTransformer2d<double, double> transformer(0.1, 0.01);
+  auto hs = transformer.transform(points);
+  auto weighted = transformer.transform(points, std::vector<uint32_t>(points.size(), 3));
+  auto lines = hs.getLines(1000);
+  for (const auto &line : lines) {
+    EXPECT_EQ(3 * hs.get(line.r, line.theta), weighted.get(line.r, line.theta));
+  }
+}
+
+TEST(radon, grayscaleLineMatchesWeightedVoting) {
+  Image<uint8_t> image(64, 48);
+  std::mt19937 gen(3);
+  std::uniform_int_distribution<int> noise(0, 20);
+  for (auto &p : image.pixels) p = static_cast<uint8_t>(noise(gen));
+  for (size_t x = 0; x < 64; ++x) image.at(x, x / 3 + 10) = 200;
+  std::vector<Point<double>> points;
+  std::vector<uint32_t> weights;
+  for (size_t y = 0; y < image.height; ++y) {
+    for (size_t x = 0; x < image.width; ++x) {
+      points.emplace_back(x, y);
+      weights.push_back(image.at(x, y));
+    }
+  }
+  HoughTransformer2d<double, double> voting(1, 0.01);
+  RadonTransformer<double, double> radon(1, 0.01);
+  auto expected = voting.transform(points, weights);
+  auto hs = radon.transform(image);
+  auto lines = hs.getLines(1);
+  ASSERT_EQ(1u, lines.size());
+  auto best = expected.getLines(1)[0];
+  EXPECT_NEAR(best.theta, lines[0].theta, 0.05);
+  EXPECT_NEAR(best.r, lines[0].r, 2);
+  // radon projections are band-limited, so a line is spread over neighbouring r cells
+  double exact = 0, approx = 0;
+  for (int d = -1; d <= 1; ++d) {
+    exact += expected.get(best.r + d, best.theta);
+    approx += hs.get(best.r + d, best.theta);
+  }
+  EXPECT_NEAR(exact, approx, 0.1 * exact);
+}
+
+TEST(anytime, completesWithLooseDeadline) {
+  auto points = generatePoints<float>(200, 300, Point<float>(-10, -10), Point<float>(10, 10));
+  HoughTransformer2d<float, float> transformer(0.01, 0.01);
+  auto result = transformer.transformUntil(points,
+                                           std::chrono::steady_clock::now() + std::chrono::hours(1));
+  EXPECT_TRUE(result.complete);
+  EXPECT_EQ(1.0, result.processed);
+  auto full = transformer.transform(points);
+  for (const auto &line : full.getLines(100)) {
+    EXPECT_EQ(full.get(line.r, line.theta), result.space.get(line.r, line.theta));
+  }
+}
+
+TEST(anytime, partialResultFindsDominantLine) {
+  std::vector<Point<double>> points;
+  std::mt19937 gen(5);
+  std::uniform_real_distribution<double> dis(0, 100);
+  for (int i = 0; i < 20000; ++i) points.emplace_back(dis(gen), dis(gen));
+  for (int i = 0; i < 20000; ++i) points.emplace_back(i * 0.005, 30);
+  HoughTransformer2d<double, double> transformer(0.5, 0.01);
+  auto expired = transformer.transformUntil(points, std::chrono::steady_clock::now());
+  EXPECT_FALSE(expired.complete);
+  EXPECT_EQ(0.0, expired.processed);
+  auto result = transformer.transformUntil(points, std::chrono::steady_clock::now() +
+                                                   std::chrono::milliseconds(10));
+  EXPECT_EQ(result.complete, result.processed == 1.0);
+  // a loaded machine may not get far in 10 ms, a small prefix is enough for the dominant line
+  if (result.processed < 0.001) return;
+  auto lines = result.space.getLines(1);
+  ASSERT_EQ(1u, lines.size());
+  EXPECT_NEAR(30, lines[0].r, 0.5);
+  EXPECT_NEAR(3.14159265359 / 2, lines[0].theta, 0.01);
+}
+
+TEST(earlyTermination, lineDominantScene) {
+  std::vector<Point<double>> points;
+  std::mt19937 gen(11);
+  std::uniform_real_distribution<double> dis(-50, 50);
+  for (int i = 0; i < 500; ++i) points.emplace_back(dis(gen), dis(gen));
+  for (int i = 0; i < 3000; ++i) points.emplace_back(dis(gen), 0.5 * points.back().x + 7);
+  for (int i = 0; i < 1500; ++i) points.emplace_back(12.3, dis(gen));
+  HoughTransformer2d<double, double> transformer(0.1, 0.01);
+  auto full = transformer.transform(points);
+  auto result = transformer.transformTop(points, 2);
+  // the two leading cells part from the rest early, a quarter of the points is left out
+  EXPECT_LT(result.voted, points.size() * 3 / 4);
+  EXPECT_FALSE(result.complete);
+  auto expected = full.getLines(2), lines = result.space.getLines(2);
+  ASSERT_EQ(2u, lines.size());
+  for (size_t i = 0; i < 2; ++i) {
+    EXPECT_EQ(expected[i].r, lines[i].r);
+    EXPECT_EQ(expected[i].theta, lines[i].theta);
+  }
+  // the third and fourth cells end one vote apart, every point is voted then
+  auto close = transformer.transformTop(points, 3);
+  EXPECT_TRUE(close.complete);
+  EXPECT_EQ(full.getSpace(), close.space.getSpace());
+}
+
+TEST(regionOfInterest, nearVerticalLines) {
+  const double pi = 3.14159265359, deg = pi / 180;
+  std::vector<Point<double>> points;
+  std::mt19937 gen(13);
+  std::uniform_real_distribution<double> dis(0, 100);
+  for (int i = 0; i < 200; ++i) points.emplace_back(dis(gen), dis(gen));
+  for (int i = 0; i < 100; ++i) points.emplace_back(0.2 * i + 30, i);
+  for (int i = 0; i < 150; ++i) points.emplace_back(i * 0.6, 40);
+  Region<double, double> region;
+  region.addTheta(-30 * deg, 30 * deg).addTheta(150 * deg, 210 * deg).setR(10, 60);
+  HoughTransformer2d<double, double> transformer(0.5, 0.01, region);
+  HoughTransformer2d<double, double> fullTransformer(0.5, 0.01);
+  auto hs = transformer.transform(points);
+  auto full = fullTransformer.transform(points);
+  auto space = hs.getSpace();
+  EXPECT_GT(full.getSpace().size() / 2, space.size());
+  EXPECT_GT(full.getSpace()[0].size() / 2, space[0].size());
+  EXPECT_EQ(0u, hs.get(40, pi / 2));
+  auto lines = hs.getLines(20);
+  ASSERT_EQ(20u, lines.size());
+  EXPECT_NEAR(30 / std::sqrt(1.04), lines[0].r, 0.5);
+  EXPECT_NEAR(2 * pi - std::atan(0.2), lines[0].theta, 0.01);
+  for (const auto &line : lines) {
+    EXPECT_TRUE(region.containsTheta(line.theta));
+    EXPECT_LE(10, line.r);
+    EXPECT_GE(60, line.r);
+    EXPECT_EQ(full.get(line.r, line.theta), hs.get(line.r, line.theta));
+  }
+  checkEachLine(lines, points, hs);
+}
+
+TEST(nonUniformTheta, explicitSamples) {
+  std::vector<double> thetas = {0.1, 0.5, 1.5, 1.5707963267949, 1.6, 3.0, 4.7, 6.0};
+  std::vector<Point<double>> points = {{0, 1.02}, {1, 1.02}, {2, 1.02}, {3, 1.02}, {-1, 0},
+                                       {2, 2}};
+  HoughTransformer2d<double, double> transformer(0.05, thetas);
+  auto hs = transformer.transform(points);
+  EXPECT_EQ(thetas.size() + 2, hs.getSpace()[0].size());
+  auto lines = hs.getLines(1000);
+  checkEachLine(lines, points, hs);
+  EXPECT_EQ(4u, hs.get(1.02, 1.5707963267949));
+  EXPECT_EQ(4u, hs.get(1.02, 1.54));
+  EXPECT_EQ(4u, hs.get(1.02, 1.58));
+  EXPECT_EQ(hs.get(1, 0.1), hs.get(1, 6.2));
+}
+
+TEST(nonUniformTheta, densityNearHorizontal) {
+  const double pi = 3.14159265359;
+  auto density = [pi](double t) {
+    return 1 + 50 * (std::exp(-(t - pi / 2) * (t - pi / 2) / 0.001) +
+                     std::exp(-(t - 3 * pi / 2) * (t - 3 * pi / 2) / 0.001));
+  };
+  auto thetas = densityThetaGrid<double>(200, density);
+  ASSERT_EQ(200u, thetas.size());
+  EXPECT_TRUE(std::is_sorted(thetas.begin(), thetas.end()));
+  size_t nearHorizontal = 0;
+  for (double t : thetas) if (std::abs(t - pi / 2) < 0.1) ++nearHorizontal;
+  EXPECT_LT(40u, nearHorizontal);
+  std::vector<Point<double>> points;
+  for (int i = 0; i < 300; ++i) points.emplace_back(i * 0.3, 0.001 * i + 20);
+  HoughTransformer2d<double, double> transformer(0.1, thetas);
+  auto hs = transformer.transform(points);
+  auto lines = hs.getLines(10);
+  checkEachLine(lines, points, hs);
+  EXPECT_NEAR(pi / 2 + std::atan(0.001 / 0.3), lines[0].theta, 0.002);
+}
+
+TEST(pointOrder, curveCodes) {
+  EXPECT_EQ(0u, mortonCode(0, 0));
+  EXPECT_EQ(1u, mortonCode(1, 0));
+  EXPECT_EQ(2u, mortonCode(0, 1));
+  EXPECT_EQ(3u, mortonCode(1, 1));
+  EXPECT_EQ(4u, mortonCode(2, 0));
+  std::vector<uint32_t> codes;
+  for (uint32_t y = 0; y < 4; ++y) {
+    for (uint32_t x = 0; x < 4; ++x) codes.push_back(hilbertCode(x, y));
+  }
+  std::sort(codes.begin(), codes.end());
+  EXPECT_EQ(codes.end(), std::unique(codes.begin(), codes.end()));
+  // consecutive cells along the Hilbert curve are neighbours
+  std::vector<std::pair<uint32_t, uint32_t>> cells(16);
+  for (uint32_t y = 0; y < 4; ++y) {
+    for (uint32_t x = 0; x < 4; ++x) cells[hilbertCode(x << 14, y << 14) >> 28] = {x, y};
+  }
+  for (size_t i = 1; i < cells.size(); ++i) {
+    EXPECT_EQ(1, std::abs(static_cast<int>(cells[i].first) - static_cast<int>(cells[i - 1].first)) +
+                 std::abs(static_cast<int>(cells[i].second) - static_cast<int>(cells[i - 1].second)));
+  }
+}
+
+TEST(pointOrder, sameSpaceInAnyOrder) {
+  auto points = generatePoints<float>(300, 400, Point<float>(-10, -10), Point<float>(10, 10));
+  HoughTransformer2d<float, float> transformer(0.05, 0.01);
+  auto expected = transformer.transform(points).getSpace();
+  EXPECT_EQ(expected, transformer.setPointOrder(PointOrder::Morton).transform(points).getSpace());
+  EXPECT_EQ(expected, transformer.setPointOrder(PointOrder::Hilbert).transform(points).getSpace());
+}
+
+TEST(mixedPrecision, binningMatchesIsOnLine) {
+  auto points = generatePoints<float>(100, 200, Point<float>(-20, -20), Point<float>(20, 20));
+  HoughTransformer2d<float, double> transformerDouble(0.05, 0.01);
+  auto hs = transformerDouble.transform(points);
+  checkEachLine(hs.getLines(500), points, hs);
+  HoughTransformer2d<float, long double> transformerLong(0.05, 0.01);
+  auto hsLong = transformerLong.transform(points);
+  checkEachLine(hsLong.getLines(500), points, hsLong);
+}
+
+TEST(staticGrid, constexprTables) {
+  static_assert(ctCos(0) == 1, "cos(0) must be exact");
+  using transformer_t = StaticHoughTransformer2d<double, 720, 100, 50>;
+  for (size_t i = 0; i < 720; ++i) {
+    EXPECT_NEAR(std::cos(transformer_t::thetaHead(i)), transformer_t::cosTable[i], 1e-12);
+    EXPECT_NEAR(std::sin(transformer_t::thetaHead(i)), transformer_t::sinTable[i], 1e-12);
+  }
+}
+
+TEST(staticGrid, matchesLinesOfPoints) {
+  std::vector<Point<float>> points;
+  std::mt19937 gen(17);
+  std::uniform_real_distribution<float> dis(0, 30);
+  for (int i = 0; i < 100; ++i) points.emplace_back(dis(gen), dis(gen));
+  for (int i = 0; i < 60; ++i) points.emplace_back(i * 0.5f, 12.25f);
+  StaticHoughTransformer2d<float, 720, 200, 50> transformer;
+  auto hs = transformer.transform(points);
+  auto lines = hs.getLines(100);
+  ASSERT_EQ(100u, lines.size());
+  for (const auto &line : lines) {
+    uint32_t cnt = 0;
+    for (const auto &p : points) {
+      if (hs.isOnLine(line, p)) ++cnt;
+    }
+    EXPECT_EQ(cnt, hs.get(line.r, line.theta));
+  }
+  EXPECT_NEAR(12.25, lines[0].r, 0.25);
+  EXPECT_NEAR(3.14159265359 / 2, lines[0].theta, 0.01);
+  EXPECT_LE(60u, hs.get(lines[0].r, lines[0].theta));
+}
+
+TEST(sparseSpace, matchesDense) {
+  std::mt19937 gen(19);
+  std::uniform_real_distribution<double> dis(-40, 40);
+  std::vector<Point<double>> points;
+  for (int i = 0; i < 200; ++i) points.emplace_back(dis(gen), dis(gen));
+  for (int i = 0; i < 50; ++i) points.emplace_back(i - 25.0, 0.5 * i + 3);
+  HoughTransformer2d<double, double> transformer(0.1, 0.01);
+  auto dense = transformer.setStorage(SpaceStorage::Dense).transform(points);
+  auto sparse = transformer.setStorage(SpaceStorage::Sparse).transform(points);
+  EXPECT_FALSE(dense.isSparse());
+  ASSERT_TRUE(sparse.isSparse());
+  EXPECT_EQ(dense.getSpace(), sparse.getSpace());
+  auto lines = sparse.getLines(50);
+  auto denseLines = dense.getLines(50);
+  ASSERT_EQ(denseLines.size(), lines.size());
+  for (size_t i = 0; i < lines.size(); ++i) {
+    EXPECT_EQ(denseLines[i].r, lines[i].r);
+    EXPECT_EQ(denseLines[i].theta, lines[i].theta);
+  }
+  checkEachLine(lines, points, sparse);
+}
+
+TEST(sparseSpace, autoForHugeExtent) {
+  // kilometre scale scene at millimetre resolution, a dense space would take terabytes
+  double theta = 1000.5 * 0.001, r = 250.0005;
+  std::vector<Point<double>> points;
+  for (int i = 0; i < 100; ++i) {
+    double t = 7.5 * i - 375;
+    points.emplace_back(r * std::cos(theta) - t * std::sin(theta),
+                        r * std::sin(theta) + t * std::cos(theta));
+  }
+  HoughTransformer2d<double, double> transformer(0.001, 0.001);
+  auto hs = transformer.transform(points);
+  ASSERT_TRUE(hs.isSparse());
+  auto lines = hs.getLines(1);
+  ASSERT_EQ(1u, lines.size());
+  EXPECT_EQ(100u, hs.get(lines[0].r, lines[0].theta));
+  EXPECT_NEAR(r, lines[0].r, 1e-9);
+  EXPECT_NEAR(theta, lines[0].theta, 1e-9);
+  checkEachLine(lines, points, hs);
+  // saved a row at a time without the grid, which codes to a few bytes per row
+  const std::string path = "sparse_space.bin";
+  ASSERT_TRUE((SpaceFile<double, double>::save(hs, path)));
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  EXPECT_GT(size_t(64) << 20, static_cast<size_t>(file.tellg()));
+  std::remove(path.c_str());
+}
+
+TEST(heavyHitters, boundsAroundExactCounts) {
+  std::mt19937 gen(23);
+  std::uniform_real_distribution<double> dis(0, 60);
+  std::vector<Point<double>> points;
+  for (int i = 0; i < 300; ++i) {
+    points.emplace_back(dis(gen), dis(gen));
+    if (i % 4 == 0) points.emplace_back(0.2 * i, 0.1 * i + 10);
+  }
+  HoughTransformer2d<double, double> transformer(0.5, 0.02);
+  auto exact = transformer.transform(points);
+  HeavyHitterSpace<double, double> stream(0.5, 0.02, 4000, 1 << 14);
+  stream.add(points);
+  EXPECT_GE(points.size() * 316u, stream.votes());
+  EXPECT_LE(stream.maxError(), stream.votes() / 4000);
+  auto lines = stream.getLines(5);
+  ASSERT_EQ(5u, lines.size());
+  auto exactTop = exact.getLines(1)[0];
+  EXPECT_EQ(exactTop.r, lines[0].r);
+  EXPECT_EQ(exactTop.theta, lines[0].theta);
+  for (const auto &line : lines) {
+    uint32_t n = exact.get(line.r, line.theta);
+    EXPECT_LE(stream.getLowerBound(line.r, line.theta), n);
+    EXPECT_GE(stream.get(line.r, line.theta), n);
+    EXPECT_LE(stream.get(line.r, line.theta), n + stream.maxError());
+    uint32_t cnt = 0;
+    for (const auto &p : points) {
+      if (stream.isOnLine(line, p)) ++cnt;
+    }
+    EXPECT_EQ(n, cnt);
+  }
+}
+
+TEST(layout, allLayoutsMatchRowMajor) {
+  auto points = generatePoints<float>(300, 400, Point<float>(-30, -30), Point<float>(30, 30));
+  HoughTransformer2d<float, float> transformer(0.2f, 0.01f);
+  auto rowMajor = transformer.transform(points);
+  auto columnMajor = transformer.setLayout(Layout::ColumnMajor).transform(points);
+  EXPECT_EQ(rowMajor.getSpace(), columnMajor.getSpace());
+  auto lines = rowMajor.getLines(100), columnLines = columnMajor.getLines(100);
+  ASSERT_EQ(lines.size(), columnLines.size());
+  for (size_t i = 0; i < lines.size(); ++i) {
+    EXPECT_EQ(lines[i].r, columnLines[i].r);
+    EXPECT_EQ(lines[i].theta, columnLines[i].theta);
+  }
+  ASSERT_EQ(2u, columnMajor.counterWidth());
+  auto view = columnMajor.view<uint16_t>(), rowView = rowMajor.view<uint16_t>();
+  EXPECT_EQ(nullptr, columnMajor.view().data);
+  auto tiled = transformer.setLayout(Layout::Tiled).transform(points);
+  EXPECT_EQ(rowMajor.getSpace(), tiled.getSpace());
+  EXPECT_EQ(nullptr, tiled.view<uint16_t>().data);
+  auto tiledLines = tiled.getLines(100);
+  ASSERT_EQ(lines.size(), tiledLines.size());
+  for (size_t i = 0; i < lines.size(); ++i) {
+    EXPECT_EQ(lines[i].r, tiledLines[i].r);
+    EXPECT_EQ(lines[i].theta, tiledLines[i].theta);
+  }
+  auto dense = rowMajor.getSpace();
+  ASSERT_EQ(dense.size(), view.rows);
+  ASSERT_EQ(dense[0].size(), view.columns);
+  EXPECT_EQ(1u, view.rowStride);
+  EXPECT_EQ(1u, rowView.columnStride);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(view.data) % Accumulator::ALIGNMENT);
+  for (size_t r = 0; r < view.rows; ++r) {
+    for (size_t c = 0; c < view.columns; ++c) {
+      ASSERT_EQ(dense[r][c], view.at(r, c));
+      ASSERT_EQ(dense[r][c], rowView.at(r, c));
+    }
+  }
+}
+
+TEST(counterWidth, narrowestForVotes) {
+  std::vector<Point<double>> points;
+  for (int i = 0; i < 200; ++i) points.emplace_back(i * 0.1, 5 + i * 0.05);
+  HoughTransformer2d<double, double> transformer(0.1, 0.01);
+  auto narrow = transformer.transform(points);
+  EXPECT_EQ(1u, narrow.counterWidth());
+  auto wide = transformer.setStorage(SpaceStorage::Sparse).transform(points);
+  EXPECT_EQ(narrow.getSpace(), wide.getSpace());
+  EXPECT_EQ(200u, narrow.get(narrow.getLines(1)[0].r, narrow.getLines(1)[0].theta));
+
+  std::vector<uint32_t> weights(points.size(), 400);
+  auto weighted = transformer.setStorage(SpaceStorage::Dense).transform(points, weights);
+  EXPECT_EQ(4u, weighted.counterWidth());
+  auto line = weighted.getLines(1)[0];
+  EXPECT_EQ(80000u, weighted.get(line.r, line.theta));
+  weights.assign(points.size(), 100);
+  auto medium = transformer.transform(points, weights);
+  EXPECT_EQ(2u, medium.counterWidth());
+  EXPECT_EQ(20000u, medium.get(line.r, line.theta));
+}
+
+TEST(counterWidth, promotionKeepsCounts) {
+  Accumulator counters(5, 7, Layout::ColumnMajor, 1);
+  counters.set(1, 2, 200);
+  counters.set(4, 6, 255);
+  counters.fit(255);
+  EXPECT_EQ(1u, counters.width);
+  counters.fit(256);
+  EXPECT_EQ(2u, counters.width);
+  counters.fit(70000);
+  EXPECT_EQ(4u, counters.width);
+  counters.set(0, 0, 70000);
+  EXPECT_EQ(200u, counters.at(1, 2));
+  EXPECT_EQ(255u, counters.at(4, 6));
+  EXPECT_EQ(70000u, counters.at(0, 0));
+  EXPECT_EQ(0u, counters.at(3, 3));
+}
+
+TEST(lazyPages, matchesEagerSpace) {
+  std::vector<Point<double>> points;
+  for (int i = 0; i < 300; ++i) points.emplace_back(2000 + i * 0.1, 3000 + (i % 7) * 0.2);
+  HoughTransformer2d<double, double> transformer(0.1, 0.01);
+  transformer.setStorage(SpaceStorage::Dense);
+  auto eager = transformer.transform(points);
+  auto lines = eager.getLines(20);
+  for (Layout layout : {Layout::RowMajor, Layout::ColumnMajor, Layout::Tiled}) {
+    auto lazy = transformer.setLayout(layout).setLazyPages(true).transform(points);
+    EXPECT_EQ(eager.getSpace(), lazy.getSpace());
+    auto lazyLines = lazy.getLines(20);
+    ASSERT_EQ(lines.size(), lazyLines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+      EXPECT_EQ(lines[i].r, lazyLines[i].r);
+      EXPECT_EQ(lines[i].theta, lazyLines[i].theta);
+      EXPECT_EQ(eager.get(lines[i].r, lines[i].theta), lazy.get(lines[i].r, lines[i].theta));
+    }
+    transformer.setLazyPages(false);
+  }
+}
+
+TEST(lazyPages, untouchedPagesReadAsZero) {
+  Backing backing;
+  backing.lazy = true;
+  Accumulator counters(1000, 1000, Layout::RowMajor, 4, backing);
+  EXPECT_EQ(0u, counters.touchedPages());
+  counters.set(500, 3, 7);
+  EXPECT_EQ(1u, counters.touchedPages());
+  EXPECT_EQ(7u, counters.at(500, 3));
+  EXPECT_EQ(0u, counters.at(900, 900));
+  size_t visited = 0;
+  counters.forEach([&visited](size_t, size_t, uint32_t) { ++visited; });
+  EXPECT_GT(counters.size(), 100 * visited);
+  counters.fit(1u << 20);
+  Accumulator copy(counters);
+  EXPECT_EQ(7u, copy.at(500, 3));
+  EXPECT_EQ(1u, copy.touchedPages());
+  copy.clear();
+  EXPECT_EQ(0u, copy.at(500, 3));
+  EXPECT_EQ(0u, copy.touchedPages());
+}
+
+TEST(hugePages, matchesRegularPages) {
+  auto points = generatePoints<float>(300, 400, Point<float>(-30, -30), Point<float>(30, 30));
+  HoughTransformer2d<float, float> transformer(0.05f, 0.005f);
+  auto regular = transformer.transform(points);
+  auto huge = transformer.setHugePages(true).transform(points);
+  EXPECT_EQ(regular.getSpace(), huge.getSpace());
+  auto lazy = transformer.setLazyPages(true).transform(points);
+  EXPECT_EQ(regular.getSpace(), lazy.getSpace());
+
+  Backing backing;
+  backing.huge = true;
+  Accumulator counters(1000, 1000, Layout::Tiled, 1, backing);
+  EXPECT_TRUE(counters.hugePages());
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(counters.data<uint8_t>()) % Accumulator::HUGE_PAGE);
+  counters.set(999, 999, 200);
+  counters.fit(1000);
+  EXPECT_TRUE(counters.hugePages());
+  EXPECT_EQ(200u, counters.at(999, 999));
+  EXPECT_EQ(0u, counters.at(0, 0));
+}
+
+TEST(outOfCore, slabsMatchInMemorySpace) {
+  auto points = generatePoints<float>(300, 400, Point<float>(-30, -30), Point<float>(30, 30));
+  HoughTransformer2d<float, float> transformer(0.2f, 0.01f);
+  auto memory = transformer.transform(points);
+  // a slab of a few dozen columns, the 630 columns take many slabs
+  OutOfCoreHoughSpace<float, float> disk(0.2f, 0.01f, 16 << 10);
+  const std::string path = "out_of_core_space.bin";
+  ASSERT_TRUE(disk.transform(points, path));
+  EXPECT_LT(10u, disk.slabs());
+  auto lines = memory.getLines(50), diskLines = disk.getLines(50);
+  ASSERT_EQ(lines.size(), diskLines.size());
+  for (size_t i = 0; i < lines.size(); ++i) {
+    EXPECT_EQ(lines[i].r, diskLines[i].r);
+    EXPECT_EQ(lines[i].theta, diskLines[i].theta);
+    EXPECT_EQ(memory.get(lines[i].r, lines[i].theta), disk.get(lines[i].r, lines[i].theta));
+    EXPECT_TRUE(disk.isOnLine(diskLines[i], points[0]) == memory.isOnLine(lines[i], points[0]));
+  }
+  EXPECT_EQ(memory.get(3.1f, 6.2f), disk.get(3.1f, 6.2f));
+  // cells of every slab forth and back, the last slab is narrower than the others
+  for (float theta = 0; theta < 6.3f; theta += 0.05f) {
+    EXPECT_EQ(memory.get(lines[0].r, theta), disk.get(lines[0].r, theta));
+    EXPECT_EQ(memory.get(lines[0].r, 6.3f - theta), disk.get(lines[0].r, 6.3f - theta));
+  }
+  EXPECT_FALSE(disk.transform(points, "missing_directory/space.bin"));
+  EXPECT_EQ(0u, disk.slabs());
+  std::remove(path.c_str());
+}
+
+TEST(transformInto, matchesTransformAndReusesCounters) {
+  HoughTransformer2d<float, float> transformer(0.2f, 0.01f);
+  transformer.setStorage(SpaceStorage::Dense);
+  auto wide = generatePoints<float>(300, 300, Point<float>(-40, -40), Point<float>(40, 40));
+  auto narrow = generatePoints<float>(300, 300, Point<float>(-20, -20), Point<float>(20, 20));
+  auto space = transformer.transform(wide);
+  const uint16_t *counters = space.view<uint16_t>().data;
+  for (const auto &points : {narrow, wide, narrow}) {
+    transformer.transformInto(points, space);
+    auto fresh = transformer.transform(points);
+    EXPECT_EQ(fresh.getSpace(), space.getSpace());
+    EXPECT_EQ(counters, space.view<uint16_t>().data);
+    auto lines = fresh.getLines(20), reused = space.getLines(20);
+    ASSERT_EQ(lines.size(), reused.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+      EXPECT_EQ(lines[i].r, reused[i].r);
+      EXPECT_EQ(lines[i].theta, reused[i].theta);
+    }
+  }
+  Region<float, float> region;
+  region.addTheta(0.5f, 1.5f);
+  region.rFrom = 5;
+  HoughTransformer2d<float, float> restricted(0.2f, 0.01f, region);
+  auto part = restricted.setLayout(Layout::ColumnMajor).setLazyPages(true).transform(narrow);
+  restricted.setStorage(SpaceStorage::Sparse).transformInto(wide, part);
+  EXPECT_TRUE(part.isSparse());
+  EXPECT_EQ(restricted.transform(wide).getSpace(), part.getSpace());
+  restricted.setStorage(SpaceStorage::Dense).transformInto(narrow, part);
+  EXPECT_EQ(restricted.transform(narrow).getSpace(), part.getSpace());
+}
+
+TEST(memoryResource, arenaServesCountersAndLines) {
+  auto points = generatePoints<float>(300, 400, Point<float>(-30, -30), Point<float>(30, 30));
+  HoughTransformer2d<float, float> transformer(0.2f, 0.01f);
+  auto heap = transformer.transform(points);
+  MonotonicArena arena(4 << 10);
+  transformer.setMemoryResource(&arena);
+  size_t capacity = 0;
+  for (int frame = 0; frame < 3; ++frame) {
+    {
+      auto space = transformer.transform(points);
+      EXPECT_EQ(heap.getSpace(), space.getSpace());
+      EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(space.view<uint16_t>().data) %
+                    Accumulator::ALIGNMENT);
+      auto lines = heap.getLines(100), arenaLines = space.getLines(100);
+      ASSERT_EQ(lines.size(), arenaLines.size());
+      for (size_t i = 0; i < lines.size(); ++i) {
+        EXPECT_EQ(lines[i].r, arenaLines[i].r);
+        EXPECT_EQ(lines[i].theta, arenaLines[i].theta);
+      }
+    }
+    // the first release merges the chunks of a frame into one, later frames fit in it
+    if (frame > 0) {
+      EXPECT_EQ(capacity, arena.capacity());
+    }
+    arena.release();
+    capacity = arena.capacity();
+  }
+  EXPECT_LT(heap.getSpace().size() * heap.getSpace()[0].size() * 2, capacity);
+}
+
+TEST(memoryResource, servesTablesAndTemporaries) {
+  // heap blocks taken through the resource and not given back yet
+  struct Counting : MemoryResource {
+    size_t live = 0, calls = 0;
+    void *allocate(size_t bytes, size_t alignment) override {
+      live += bytes;
+      ++calls;
+      return heapResource()->allocate(bytes, alignment);
+    }
+    void deallocate(void *p, size_t bytes, size_t alignment) override {
+      live -= bytes;
+      heapResource()->deallocate(p, bytes, alignment);
+    }
+  } counting;
+  auto points = generatePoints<float>(300, 400, Point<float>(-30, -30), Point<float>(30, 30));
+  HoughTransformer2d<float, float> transformer(0.2f, 0.01f);
+  transformer.setMemoryResource(&counting).setPointOrder(PointOrder::Hilbert);
+  for (SpaceStorage storage : {SpaceStorage::Dense, SpaceStorage::Sparse}) {
+    {
+      auto space = transformer.setStorage(storage).transform(points);
+      auto cells = space.getSpace();
+      // the head and trigonometry tables of every column, and the counters
+      size_t bytes = 3 * cells[0].size() * sizeof(float) +
+                     (space.isSparse() ? space.getLines(1000).size() * sizeof(uint64_t)
+                                       : cells.size() * cells[0].size() * space.counterWidth());
+      EXPECT_LE(bytes, counting.live);
+      // the point orders of transforms come from it and go back to it
+      size_t live = counting.live, calls = counting.calls;
+      transformer.transformInto(points, space);
+      transformer.transformTop(points, 1);
+      EXPECT_EQ(live, counting.live);
+      EXPECT_LT(calls + 2, counting.calls);
+    }
+    EXPECT_EQ(0u, counting.live);
+  }
+  // a space reshaped for another resource takes its tables along
+  auto space = transformer.setStorage(SpaceStorage::Dense).transform(points);
+  transformer.setMemoryResource(nullptr).transformInto(points, space);
+  EXPECT_EQ(0u, counting.live);
+  EXPECT_EQ(transformer.transform(points).getSpace(), space.getSpace());
+}
+
+TEST(spaceView, headsAndCountersInPlace) {
+  auto points = generatePoints<float>(300, 400, Point<float>(-30, -30), Point<float>(30, 30));
+  HoughTransformer2d<float, float> transformer(0.2f, 0.01f);
+  auto space = transformer.setLayout(Layout::ColumnMajor).transform(points);
+  auto view = space.view<uint16_t>();
+  ASSERT_NE(nullptr, view.data);
+  auto dense = space.getSpace();
+  ASSERT_EQ(dense.size(), view.rows);
+  ASSERT_EQ(dense[0].size(), view.columns);
+  for (size_t i = 0; i + 2 < view.rows; ++i) {
+    for (size_t j = 0; j + 2 < view.columns; ++j) {
+      ASSERT_EQ(dense[i][j], view.at(i, j));
+      if (dense[i][j] != 0) {
+        ASSERT_EQ(dense[i][j], space.get(view.r[i], view.theta[j]));
+      }
+    }
+  }
+  auto line = space.getLines(1)[0];
+  EXPECT_NE(view.r + view.rows, std::find(view.r, view.r + view.rows, line.r));
+  EXPECT_NE(view.theta + view.columns,
+            std::find(view.theta, view.theta + view.columns, line.theta));
+  auto sparse = transformer.setStorage(SpaceStorage::Sparse).transform(points);
+  EXPECT_EQ(nullptr, sparse.view<uint16_t>().data);
+  EXPECT_EQ(view.r[7], sparse.view<uint16_t>().r[7]);
+}
+
+TEST(spaceFile, loadAndOpenGiveSavedSpace) {
+  auto points = generatePoints<float>(300, 400, Point<float>(-30, -30), Point<float>(30, 30));
+  Region<float, float> region;
+  region.addTheta(1.0f, 2.5f).setR(5.0f, 25.0f);
+  HoughTransformer2d<float, float> full(0.2f, 0.01f), partial(0.2f, 0.01f, region);
+  using file_t = SpaceFile<float, float>;
+  const std::string path = "space_file.bin";
+  for (auto saved : {full.setLayout(Layout::Tiled).transform(points),
+                     partial.transform(points),
+                     partial.setStorage(SpaceStorage::Sparse).transform(points)}) {
+    ASSERT_TRUE(file_t::save(saved, path));
+    std::unique_ptr<HoughSpace<float, float>> loaded, opened;
+    ASSERT_TRUE(file_t::load(path, loaded));
+    ASSERT_TRUE(file_t::open(path, opened));
+    EXPECT_EQ(saved.getSpace(), loaded->getSpace());
+    EXPECT_EQ(saved.getSpace(), opened->getSpace());
+    auto lines = saved.getLines(30), openedLines = opened->getLines(30);
+    ASSERT_EQ(lines.size(), openedLines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+      EXPECT_EQ(lines[i].r, openedLines[i].r);
+      EXPECT_EQ(lines[i].theta, openedLines[i].theta);
+      EXPECT_EQ(saved.get(lines[i].r, lines[i].theta), loaded->get(lines[i].r, lines[i].theta));
+      EXPECT_EQ(saved.isOnLine(lines[i], points[0]), opened->isOnLine(lines[i], points[0]));
+    }
+  }
+  // a file of version 1: the header ends 8 bytes earlier, without encoding
+  auto saved = partial.setStorage(SpaceStorage::Dense).transform(points);
+  ASSERT_TRUE(file_t::save(saved, path));
+  std::string bytes;
+  {
+    std::ifstream in(path, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  uint32_t version = 1;
+  std::memcpy(&bytes[8], &version, sizeof(version));
+  // theta cells and padding up to the counters, which stay on their page
+  std::string cells(bytes.begin() + 128, bytes.begin() + 4096);
+  bytes = bytes.substr(0, 96) + bytes.substr(104, 24) + cells + std::string(8, '\0') +
+          bytes.substr(4096);
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+  }
+  std::unique_ptr<HoughSpace<float, float>> old, oldOpened;
+  ASSERT_TRUE(file_t::load(path, old));
+  ASSERT_TRUE(file_t::open(path, oldOpened));
+  EXPECT_EQ(saved.getSpace(), old->getSpace());
+  EXPECT_EQ(saved.getSpace(), oldOpened->getSpace());
+  std::unique_ptr<HoughSpace<double, double>> other;
+  EXPECT_FALSE((SpaceFile<double, double>::load(path, other)));
+  // spaces over a non-uniform grid are not saved
+  HoughTransformer2d<float, float> samples(0.2f, std::vector<float>{0.5f, 1.5f});
+  EXPECT_FALSE(file_t::save(samples.transform(points), path));
+  std::remove(path.c_str());
+}
+
+TEST(spaceCodec, codeRoundTripsAndShrinksSparseSpaces) {
+  std::vector<uint32_t> counters(1000, 0), decoded(1000);
+  counters[3] = 7;
+  counters[4] = 7;
+  counters[500] = std::numeric_limits<uint32_t>::max();
+  counters[501] = 1;
+  std::fill(counters.begin() + 700, counters.begin() + 800, 300);
+  std::vector<uint8_t> code;
+  SpaceCodec::encode(counters.data(), counters.size(), 128, code);
+  EXPECT_GT(200u, code.size());
+  ASSERT_TRUE(SpaceCodec::decode(code.data(), code.size(), decoded.data(), decoded.size(), 128));
+  EXPECT_EQ(counters, decoded);
+  EXPECT_FALSE(SpaceCodec::decode(code.data(), code.size() - 1, decoded.data(), 1000, 128));
+  std::vector<uint8_t> narrow(1000);
+  EXPECT_FALSE(SpaceCodec::decode(code.data(), code.size(), narrow.data(), 1000, 128));
+  std::vector<uint8_t> cut;
+  EXPECT_FALSE(SpaceCodec::encode(counters.data(), counters.size(), 128, cut, code.size() / 2));
+
+  // a few points over a fine grid hit a small part of the cells
+  auto points = generatePoints<float>(3, 4, Point<float>(-30, -30), Point<float>(30, 30));
+  HoughTransformer2d<float, float> transformer(0.05f, 0.005f);
+  using file_t = SpaceFile<float, float>;
+  const std::string path = "space_codec.bin";
+  for (Layout layout : {Layout::RowMajor, Layout::ColumnMajor, Layout::Tiled}) {
+    auto saved = transformer.setLayout(layout).transform(points);
+    ASSERT_TRUE(file_t::save(saved, path, SpaceEncoding::Compressed));
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    auto cells = saved.getSpace().size() * saved.getSpace()[0].size();
+    EXPECT_GT(cells * saved.counterWidth(), static_cast<size_t>(file.tellg()) * 2);
+    std::unique_ptr<HoughSpace<float, float>> loaded, opened;
+    ASSERT_TRUE(file_t::load(path, loaded));
+    ASSERT_TRUE(file_t::open(path, opened));
+    EXPECT_EQ(saved.getSpace(), loaded->getSpace());
+    EXPECT_EQ(saved.getSpace(), opened->getSpace());
+  }
+  // most cells of a dense space are hit, it is saved raw
+  auto many = generatePoints<float>(3000, 4000, Point<float>(-30, -30), Point<float>(30, 30));
+  auto dense = transformer.setLayout(Layout::RowMajor).transform(many);
+  ASSERT_TRUE(file_t::save(dense, path, SpaceEncoding::Compressed));
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  auto cells = dense.getSpace().size() * dense.getSpace()[0].size();
+  EXPECT_LE(cells * dense.counterWidth(), static_cast<size_t>(file.tellg()));
+  std::unique_ptr<HoughSpace<float, float>> opened;
+  ASSERT_TRUE(file_t::open(path, opened));
+  EXPECT_EQ(dense.getSpace(), opened->getSpace());
+  std::remove(path.c_str());
+}
+
+TEST(mergeSpaces, shardsSumToWholeSet) {
+  auto points = generatePoints<float>(300, 400, Point<float>(-30, -30), Point<float>(30, 30));
+  float maxR = 0;
+  for (const auto &p : points) maxR = std::max(maxR, std::sqrt(p.x * p.x + p.y * p.y));
+  for (Layout layout : {Layout::RowMajor, Layout::ColumnMajor, Layout::Tiled}) {
+    HoughTransformer2d<float, float> transformer(0.2f, 0.01f);
+    transformer.setLayout(layout).setMaxR(maxR);
+    auto whole = transformer.transform(points);
+    std::vector<Point<float>> first(points.begin(), points.begin() + 100),
+                              second(points.begin() + 100, points.begin() + 250),
+                              third(points.begin() + 250, points.end());
+    auto merged = transformer.transform(first);
+    // shards may keep their counters otherwise: squares of cells of another layout and
+    // cells of a sparse space merge to the same sum
+    Layout other = layout == Layout::RowMajor ? Layout::Tiled : Layout::RowMajor;
+    merged += transformer.setLayout(other).transform(second);
+    ASSERT_TRUE(merged.merge(transformer.setStorage(SpaceStorage::Sparse).transform(third)));
+    EXPECT_EQ(whole.getSpace(), merged.getSpace());
+    auto lines = whole.getLines(30), mergedLines = merged.getLines(30);
+    ASSERT_EQ(lines.size(), mergedLines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+      EXPECT_EQ(lines[i].r, mergedLines[i].r);
+      EXPECT_EQ(lines[i].theta, mergedLines[i].theta);
+    }
+  }
+  HoughTransformer2d<float, float> coarse(0.4f, 0.01f);
+  auto space = HoughTransformer2d<float, float>(0.2f, 0.01f).transform(points);
+  auto before = space.getSpace();
+  EXPECT_FALSE(space.merge(coarse.transform(points)));
+  // rows beyond those of the space
+  EXPECT_FALSE(space.merge(HoughTransformer2d<float, float>(0.2f, 0.01f).setMaxR(100)
+                             .transform(points)));
+  EXPECT_EQ(before, space.getSpace());
+}
+
+TEST(removePoints, editsMatchTransformOfCorrectedSet) {
+  auto points = generatePoints<float>(300, 400, Point<float>(-30, -30), Point<float>(30, 30));
+  std::vector<Point<float>> kept(points.begin() + 50, points.end()),
+                            retracted(points.begin(), points.begin() + 50);
+  float maxR = 0;
+  for (const auto &p : points) maxR = std::max(maxR, std::sqrt(p.x * p.x + p.y * p.y));
+  // the rows of the whole set, the farthest point may be a retracted one
+  HoughTransformer2d<float, float> transformer(0.2f, 0.01f);
+  transformer.setMaxR(maxR);
+  for (SpaceStorage storage : {SpaceStorage::Dense, SpaceStorage::Sparse}) {
+    for (bool lazy : {false, true}) {
+      transformer.setStorage(storage).setLazyPages(lazy).setLayout(Layout::Tiled);
+      auto space = transformer.transform(points);
+      auto corrected = transformer.transform(kept);
+      ASSERT_TRUE(space.removePoints(retracted));
+      EXPECT_EQ(corrected.getSpace(), space.getSpace());
+      // a point that was never voted, every cell it hits is empty or taken back
+      auto before = space.getSpace();
+      std::vector<Point<float>> again(kept.begin(), kept.begin() + 10);
+      again.push_back(retracted[0]);
+      EXPECT_FALSE(space.removePoints(again));
+      EXPECT_EQ(before, space.getSpace());
+      ASSERT_TRUE(space.addPoints(retracted));
+      EXPECT_EQ(transformer.transform(points).getSpace(), space.getSpace());
+      // a point beyond the rows is not voted into the padding rows or dropped
+      std::vector<Point<float>> far(retracted.begin(), retracted.begin() + 10);
+      far.emplace_back(2 * maxR, 0.0f);
+      before = space.getSpace();
+      EXPECT_FALSE(space.addPoints(far));
+      EXPECT_EQ(before, space.getSpace());
+    }
+  }
+}
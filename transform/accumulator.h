@@ -0,0 +1,495 @@
+#ifndef ACCUMULATOR_H
+#define ACCUMULATOR_H
+
+#include <memory>
+#include <vector>
+#include <limits>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include "memory_resource.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define ACCUMULATOR_MMAP 1
+#endif
+
+/*
+ * Order of cells in the counter buffer. RowMajor keeps the theta columns of an r row next
+ * to each other, which suits voting one point over all columns; ColumnMajor keeps the r rows
+ * of a column together, which suits points voted in space-filling curve order and per column
+ * scans. Tiled stores TILE x TILE blocks of cells one after another, row-major inside a block
+ * and between blocks, so a neighbourhood of a cell spans few cache lines in both directions
+ * while a vote still walks consecutive columns of a block row.
+*/
+enum class Layout { RowMajor, ColumnMajor, Tiled };
+
+/*
+ * Read-only strided view of counters, cell (row, column) is
+ * data[row * rowStride + column * columnStride]
+*/
+template <typename T>
+struct SpaceView {
+  const T *data;
+  size_t rows, columns;
+  size_t rowStride, columnStride;
+
+  T at(size_t row, size_t column) const { return data[row * rowStride + column * columnStride]; }
+};
+
+/*
+ * Where the counters of an accumulator live, see Accumulator
+ * @field lazy - pages mapped from the system and zeroed on the first write
+ * @field huge - buffer on huge pages when the system provides them
+ * @field file - descriptor of a file open for reading and writing at least offset + bytes()
+ *  long that holds the counters, -1 for counters in memory
+ * @field shared - writes to counters on a file go to the file, otherwise the file is only
+ *  read and written pages are copied to memory, so it may be open for reading only
+ * @field resource - memory resource of a buffer that is neither mapped nor on a file
+*/
+struct Backing {
+  bool lazy, huge, shared;
+  int file;
+  uint64_t offset;
+  MemoryResource *resource;
+  Backing() : lazy(false), huge(false), shared(true), file(-1), offset(0),
+    resource(heapResource()) {}
+};
+
+/*
+ * Counters of a dense space in one zero-initialized buffer aligned to a cache line.
+ * Counters are 1, 2 or 4 bytes wide; the owner keeps a bound of the largest count and calls
+ * fit before it can be exceeded, which rebuilds the buffer with wider counters.
+ * Cell (row, column) is at rowOffset(row) + columnOffset[column] for every layout.
+ * A lazy accumulator maps its buffer from the system without touching it: pages are
+ * allocated and zeroed by the kernel on the first write, writers mark them in touched, and
+ * untouched pages read as zero and are skipped by forEach. Setup and resident memory then
+ * follow the cells actually voted.
+ * A huge accumulator asks for HUGE_PAGE pages, so that scattered votes into a buffer of
+ * hundreds of megabytes do not miss the TLB on nearly every write: explicit huge pages
+ * (MAP_HUGETLB) when the system has reserved some, otherwise a mapping aligned to HUGE_PAGE
+ * and advised for transparent huge pages, otherwise regular pages.
+ * A file accumulator maps bytes() of an open file from an offset and shares its counters
+ * with the file: they are not cleared, and written pages go back to the file instead of
+ * taking memory, so spaces larger than memory are voted a part at a time. Its width should
+ * hold every count from the start, as fit and copies move counters to memory. A private
+ * file accumulator only reads the file, e.g. counters saved by another process.
+ * Any other buffer comes from the memory resource of the backing, e.g. a per-frame arena.
+*/
+struct Accumulator {
+  static const size_t ALIGNMENT = 64;
+  // side of a block of the tiled layout
+  static const size_t TILE = 16;
+  // size of a huge page on x86-64 and most ARM64 kernels
+  static const size_t HUGE_PAGE = 2 << 20;
+
+  Accumulator() : rows(0), columns(0), rowStride(0), columnStride(0), layout(Layout::RowMajor),
+    width(4), pageShift(0), huge(false), resource(heapResource()), cells(0), allocated(0) {}
+
+  Accumulator(size_t rows, size_t columns, Layout layout, unsigned width = 4,
+              const Backing &backing = Backing()) :
+    columnOffset(ResourceAllocator<size_t>(backing.resource)), pageShift(0),
+    huge(backing.huge), resource(backing.resource), cells(0), allocated(0) {
+    shape(rows, columns, layout, width);
+    if (backing.file >= 0) {
+      mapFile(backing.file, backing.offset, backing.shared);
+      return;
+    }
+    allocate(backing.lazy);
+    if (!isLazy()) clear();
+  }
+
+  Accumulator(const Accumulator &rhs) : rows(rhs.rows), columns(rhs.columns),
+    rowStride(rhs.rowStride), columnStride(rhs.columnStride), layout(rhs.layout),
+    width(rhs.width), columnOffset(rhs.columnOffset), pageShift(0), huge(rhs.huge),
+    resource(rhs.resource), cells(rhs.cells), allocated(0) {
+    allocate(rhs.isLazy());
+    if (!isLazy()) {
+      if (cells != 0) std::memcpy(buffer.get(), rhs.buffer.get(), bytes());
+      return;
+    }
+    touched = rhs.touched;
+    for (size_t p = 0; p != touched.size(); ++p) {
+      if (touched[p]) std::memcpy(pageData(p), rhs.pageData(p), pageBytes(p));
+    }
+  }
+
+  Accumulator(Accumulator &&rhs) = default;
+
+  Accumulator &operator=(Accumulator rhs) {
+    std::swap(buffer, rhs.buffer);
+    rows = rhs.rows;
+    columns = rhs.columns;
+    rowStride = rhs.rowStride;
+    columnStride = rhs.columnStride;
+    layout = rhs.layout;
+    width = rhs.width;
+    columnOffset.swap(rhs.columnOffset);
+    touched.swap(rhs.touched);
+    pageShift = rhs.pageShift;
+    huge = rhs.huge;
+    resource = rhs.resource;
+    cells = rhs.cells;
+    allocated = rhs.allocated;
+    return *this;
+  }
+
+  /*
+   * Part of a cell position that depends on the row only. In the tiled layout rowStride is
+   * the size of a row of blocks
+  */
+  size_t rowOffset(size_t row) const {
+    return layout == Layout::Tiled ? row / TILE * rowStride + row % TILE * TILE : row * rowStride;
+  }
+
+  size_t index(size_t row, size_t column) const { return rowOffset(row) + columnOffset[column]; }
+
+  uint32_t at(size_t row, size_t column) const {
+    size_t i = index(row, column);
+    if (!isTouched(i)) return 0;
+    switch (width) {
+      case 1: return data<uint8_t>()[i];
+      case 2: return data<uint16_t>()[i];
+      default: return data<uint32_t>()[i];
+    }
+  }
+
+  void set(size_t row, size_t column, uint32_t value) {
+    size_t i = index(row, column);
+    touch(i);
+    switch (width) {
+      case 1: data<uint8_t>()[i] = static_cast<uint8_t>(value); break;
+      case 2: data<uint16_t>()[i] = static_cast<uint16_t>(value); break;
+      default: data<uint32_t>()[i] = value;
+    }
+  }
+
+  // counters of width sizeof(T)
+  template <typename T>
+  T *data() { return reinterpret_cast<T *>(buffer.get()); }
+  template <typename T>
+  const T *data() const { return reinterpret_cast<const T *>(buffer.get()); }
+
+  // amount of cells
+  size_t size() const { return rows * columns; }
+
+  // size of the buffer, the tiled layout pads rows and columns to whole blocks
+  size_t bytes() const { return cells * width; }
+
+  // size of the buffer of a geometry
+  static size_t bytesOf(size_t rows, size_t columns, Layout layout, unsigned width) {
+    if (layout != Layout::Tiled) return rows * columns * width;
+    return (rows + TILE - 1) / TILE * ((columns + TILE - 1) / TILE) * TILE * TILE * width;
+  }
+
+  static uint32_t maxCount(unsigned width) {
+    return width == 1 ? 0xff : (width == 2 ? 0xffff : std::numeric_limits<uint32_t>::max());
+  }
+
+  /*
+   * Narrowest width that holds counts up to bound
+  */
+  static unsigned widthFor(uint64_t bound) {
+    return bound <= maxCount(1) ? 1 : (bound <= maxCount(2) ? 2 : 4);
+  }
+
+  /*
+   * Makes counters wide enough for counts up to bound, rebuilding the buffer in one pass
+  */
+  void fit(uint64_t bound) {
+    if (bound <= maxCount(width) || width == 4) return;
+    Backing backing;
+    backing.lazy = isLazy();
+    backing.huge = huge;
+    backing.resource = resource;
+    Accumulator wider(rows, columns, layout, widthFor(bound), backing);
+    forEach([&wider](size_t row, size_t column, uint32_t c) { wider.set(row, column, c); });
+    *this = std::move(wider);
+  }
+
+  /*
+   * Counters in place, null when T is not the counter type or the layout is tiled
+  */
+  template <typename T>
+  SpaceView<T> view() const {
+    bool strided = sizeof(T) == width && layout != Layout::Tiled;
+    return SpaceView<T>{strided ? data<T>() : nullptr, rows, columns, rowStride, columnStride};
+  }
+
+  void clear() {
+    if (!isLazy()) {
+      if (cells != 0) std::memset(buffer.get(), 0, bytes());
+      return;
+    }
+    for (size_t p = 0; p != touched.size(); ++p) {
+      if (touched[p]) std::memset(pageData(p), 0, pageBytes(p));
+      touched[p] = 0;
+    }
+  }
+
+  /*
+   * Zeroed counters of a new geometry, in the buffer already allocated when it is large
+   * enough, so a space reused for frames of similar extent does not allocate. A lazy buffer
+   * clears only its written pages. Not for an accumulator on a file
+  */
+  void reshape(size_t rows, size_t columns, Layout layout, unsigned width) {
+    bool lazy = isLazy();
+    if (lazy) clear();
+    shape(rows, columns, layout, width);
+    if (bytes() > allocated) {
+      buffer.reset();
+      pageShift = 0;
+      touched.clear();
+      allocate(lazy);
+      if (!isLazy()) clear();
+      return;
+    }
+    if (lazy) {
+      touched.resize(pages(pageShift), 0);
+    } else {
+      clear();
+    }
+  }
+
+  bool isLazy() const { return pageShift != 0; }
+
+  // huge pages were asked for, whether the system provided them is up to it
+  bool hugePages() const { return huge; }
+
+  MemoryResource *memoryResource() const { return resource; }
+
+  /*
+   * Marks the page of cell at position i as written, writers through data() call it
+   * for every write of a lazy accumulator
+  */
+  void touch(size_t i) {
+    if (isLazy()) touched[i * width >> pageShift] = 1;
+  }
+
+  bool isTouched(size_t i) const { return !isLazy() || touched[i * width >> pageShift]; }
+
+  // amount of pages written to a lazy accumulator
+  size_t touchedPages() const {
+    size_t n = 0;
+    for (uint8_t t : touched) n += t;
+    return n;
+  }
+
+  /*
+   * Calls f(row, column, count) for every cell in the order of the buffer
+  */
+  template <typename F>
+  void forEach(F f) const {
+    switch (width) {
+      case 1: forEach(data<uint8_t>(), f); break;
+      case 2: forEach(data<uint16_t>(), f); break;
+      default: forEach(data<uint32_t>(), f);
+    }
+  }
+
+  size_t rows, columns;
+  size_t rowStride, columnStride;
+  Layout layout;
+  // bytes per counter
+  unsigned width;
+  ResourceVector<size_t> columnOffset;
+  // written pages of a lazy accumulator, page size is 2^pageShift bytes (0 when not lazy)
+  std::vector<uint8_t> touched;
+  unsigned pageShift;
+
+private:
+  /*
+   * Memory of the buffer goes back where it came from: munmap of mapped bytes starting skew
+   * bytes before the buffer, or size bytes to the resource
+  */
+  struct Free {
+    size_t mapped, skew, size;
+    MemoryResource *resource;
+    Free() : mapped(0), skew(0), size(0), resource(nullptr) {}
+    void operator()(unsigned char *p) const {
+#ifdef ACCUMULATOR_MMAP
+      if (mapped != 0) {
+        munmap(p - skew, mapped);
+        return;
+      }
+#endif
+      resource->deallocate(p, size, ALIGNMENT);
+    }
+  };
+
+  size_t pages(unsigned shift) const { return (bytes() + (size_t(1) << shift) - 1) >> shift; }
+
+  unsigned char *pageData(size_t p) { return buffer.get() + (p << pageShift); }
+  const unsigned char *pageData(size_t p) const { return buffer.get() + (p << pageShift); }
+
+  size_t pageBytes(size_t p) const {
+    return std::min(size_t(1) << pageShift, bytes() - (p << pageShift));
+  }
+
+  /*
+   * Calls f(position, k) for k in [0, n) of a contiguous run of cells from position,
+   * skipping untouched pages
+  */
+  template <typename G>
+  void forRun(size_t position, size_t n, G f) const {
+    if (!isLazy()) {
+      for (size_t k = 0; k < n; ++k) f(position + k, k);
+      return;
+    }
+    size_t perPage = (size_t(1) << pageShift) / width;
+    for (size_t k = 0; k < n; ) {
+      size_t end = std::min(n, ((position + k) / perPage + 1) * perPage - position);
+      if (touched[(position + k) / perPage]) {
+        for (; k < end; ++k) f(position + k, k);
+      }
+      k = end;
+    }
+  }
+
+  template <typename T, typename F>
+  void forEach(const T *counters, F f) const {
+    if (layout == Layout::Tiled) {
+      for (size_t r0 = 0; r0 < rows; r0 += TILE) {
+        size_t r1 = std::min(rows, r0 + TILE);
+        for (size_t c0 = 0; c0 < columns; c0 += TILE) {
+          size_t c1 = std::min(columns, c0 + TILE);
+          for (size_t r = r0; r < r1; ++r) {
+            forRun(index(r, c0), c1 - c0, [&](size_t i, size_t k) { f(r, c0 + k, counters[i]); });
+          }
+        }
+      }
+      return;
+    }
+    if (layout == Layout::RowMajor) {
+      for (size_t r = 0; r < rows; ++r) {
+        forRun(r * columns, columns, [&](size_t i, size_t c) { f(r, c, counters[i]); });
+      }
+      return;
+    }
+    for (size_t c = 0; c < columns; ++c) {
+      forRun(c * rows, rows, [&](size_t i, size_t r) { f(r, c, counters[i]); });
+    }
+  }
+
+  void allocate(bool lazy) {
+    allocated = bytes();
+    if (cells == 0) return;
+#ifdef ACCUMULATOR_MMAP
+    if (lazy || huge) {
+      size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE)), mapped = 0;
+      unsigned shift = 0;
+      while ((size_t(1) << shift) < page) ++shift;
+      unsigned char *p = huge ? mapHuge(mapped) : nullptr;
+      if (p == nullptr) {
+        mapped = pages(shift) << shift;
+        p = map(mapped);
+      }
+      buffer = std::unique_ptr<unsigned char, Free>(p, Free());
+      buffer.get_deleter().mapped = mapped;
+      if (lazy) {
+        pageShift = shift;
+        touched.assign(pages(pageShift), 0);
+      }
+      return;
+    }
+#else
+    (void) lazy;
+#endif
+    size_t rounded = (bytes() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    void *p = resource->allocate(rounded, ALIGNMENT);
+    buffer = std::unique_ptr<unsigned char, Free>(static_cast<unsigned char *>(p), Free());
+    buffer.get_deleter().size = rounded;
+    buffer.get_deleter().resource = resource;
+  }
+
+  void shape(size_t rows, size_t columns, Layout layout, unsigned width) {
+    this->rows = rows;
+    this->columns = columns;
+    this->layout = layout;
+    this->width = width;
+    if (layout == Layout::Tiled) {
+      size_t tileColumns = (columns + TILE - 1) / TILE;
+      rowStride = tileColumns * TILE * TILE;
+      columnStride = 0;
+      cells = (rows + TILE - 1) / TILE * rowStride;
+    } else {
+      rowStride = layout == Layout::RowMajor ? columns : 1;
+      columnStride = layout == Layout::RowMajor ? 1 : rows;
+      cells = rows * columns;
+    }
+    columnOffset.resize(columns);
+    for (size_t c = 0; c < columns; ++c) {
+      columnOffset[c] = layout == Layout::Tiled ? c / TILE * TILE * TILE + c % TILE
+                                                : c * columnStride;
+    }
+  }
+
+  /*
+   * Mapping of the counters in file from offset, which need not be page aligned:
+   * the mapping starts at the page of offset. A private mapping copies written pages
+  */
+  void mapFile(int file, uint64_t offset, bool shared) {
+#ifdef ACCUMULATOR_MMAP
+    if (cells == 0) return;
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t skew = static_cast<size_t>(offset % page), mapped = skew + bytes();
+    void *p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE,
+                   file, static_cast<off_t>(offset - skew));
+    if (p == MAP_FAILED) throw std::bad_alloc();
+    buffer = std::unique_ptr<unsigned char, Free>(static_cast<unsigned char *>(p) + skew, Free());
+    buffer.get_deleter().mapped = mapped;
+    buffer.get_deleter().skew = skew;
+    allocated = bytes();
+#else
+    (void) file;
+    (void) offset;
+    (void) shared;
+    throw std::bad_alloc();
+#endif
+  }
+
+#ifdef ACCUMULATOR_MMAP
+  static unsigned char *map(size_t length, int flags = 0) {
+    void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags,
+                   -1, 0);
+    if (p == MAP_FAILED) {
+      if (flags != 0) return nullptr;
+      throw std::bad_alloc();
+    }
+    return static_cast<unsigned char *>(p);
+  }
+
+  /*
+   * Buffer in whole huge pages, null when the system has none to give. Transparent huge
+   * pages back only aligned ranges, so the mapping is over-allocated by a huge page and
+   * trimmed to an aligned start
+  */
+  unsigned char *mapHuge(size_t &mapped) const {
+    mapped = (bytes() + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+#ifdef MAP_HUGETLB
+    if (unsigned char *p = map(mapped, MAP_HUGETLB)) return p;
+#endif
+#ifdef MADV_HUGEPAGE
+    unsigned char *base = map(mapped + HUGE_PAGE);
+    size_t head = (HUGE_PAGE - reinterpret_cast<uintptr_t>(base) % HUGE_PAGE) % HUGE_PAGE;
+    if (head != 0) munmap(base, head);
+    munmap(base + head + mapped, HUGE_PAGE - head);
+    madvise(base + head, mapped, MADV_HUGEPAGE);
+    return base + head;
+#else
+    return nullptr;
+#endif
+  }
+#endif
+
+  bool huge;
+  MemoryResource *resource;
+  // cells in use and bytes of the buffer
+  size_t cells, allocated;
+  std::unique_ptr<unsigned char, Free> buffer;
+};
+
+#endif // ACCUMULATOR_H
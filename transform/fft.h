@@ -0,0 +1,62 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <cassert>
+
+/*
+ * Iterative radix-2 Cooley-Tukey FFT, size of data must be a power of two.
+ * @param inverse - computes inverse transform, including the 1/n normalization
+*/
+inline void fft(std::vector<std::complex<double>> &data, bool inverse) {
+  size_t n = data.size();
+  assert((n & (n - 1)) == 0);
+  for (size_t i = 1, j = 0; i < n; ++i) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) std::swap(data[i], data[j]);
+  }
+  const double pi = 3.14159265358979323846;
+  std::vector<std::complex<double>> roots(n / 2);
+  for (size_t k = 0; k < n / 2; ++k) {
+    double angle = (inverse ? 2 : -2) * pi * static_cast<double>(k) / static_cast<double>(n);
+    roots[k] = std::complex<double>(std::cos(angle), std::sin(angle));
+  }
+  for (size_t len = 2; len <= n; len <<= 1) {
+    size_t half = len >> 1, stride = n / len;
+    for (size_t i = 0; i < n; i += len) {
+      for (size_t k = 0; k < half; ++k) {
+        std::complex<double> u = data[i + k];
+        std::complex<double> v = data[i + k + half] * roots[k * stride];
+        data[i + k] = u + v;
+        data[i + k + half] = u - v;
+      }
+    }
+  }
+  if (inverse) {
+    for (auto &v : data) v /= static_cast<double>(n);
+  }
+}
+
+/*
+ * Two-dimensional FFT of n x n matrix stored row by row
+*/
+inline void fft2d(std::vector<std::complex<double>> &data, size_t n, bool inverse) {
+  assert(data.size() == n * n);
+  std::vector<std::complex<double>> line(n);
+  for (size_t y = 0; y < n; ++y) {
+    std::copy(data.begin() + y * n, data.begin() + (y + 1) * n, line.begin());
+    fft(line, inverse);
+    std::copy(line.begin(), line.end(), data.begin() + y * n);
+  }
+  for (size_t x = 0; x < n; ++x) {
+    for (size_t y = 0; y < n; ++y) line[y] = data[y * n + x];
+    fft(line, inverse);
+    for (size_t y = 0; y < n; ++y) data[y * n + x] = line[y];
+  }
+}
+
+#endif // FFT_H
@@ -0,0 +1,384 @@
+#ifndef HEAVY_HITTER_SPACE_H
+#define HEAVY_HITTER_SPACE_H
+
+#include "utils.h"
+#include "hough_transform.h"
+#include "kernels.h"
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+/*
+ * Approximate accumulator of constant memory for unbounded streams of points: only the
+ * heaviest cells are kept, in a Space-Saving summary of capacity counters, and every vote is
+ * also counted in a count-min sketch of depth x width counters. A cell taking over the
+ * smallest counter starts from the sketch estimate when it is below the Space-Saving bound,
+ * so noise cells do not inherit large counts and the order of the summary stays meaningful,
+ * and a cell whose estimate does not exceed the smallest counter does not take it over.
+ * The grid is the regular one of HoughTransformer2d with rows from r = 0 and no bound on r.
+ * Bounds for a cell voted n times in total of votes:
+ *  - n <= count <= n + maxError, count - error <= n, maxError <= votes / capacity,
+ *    any cell with n > votes / capacity is in the summary
+ *  - n <= estimate <= n + e * votes / width with probability 1 - exp(-depth)
+ * get reports the smaller of the two upper bounds, getLowerBound the guaranteed lower one.
+ * Votes are unit, so a vote moves a counter inside the summary sorted by count in O(1) and
+ * getLines(amount) reads the first amount counters. Tracked cells and count blocks are found
+ * through open addressing indexes of fixed size, and the cells of a point are counted in the
+ * sketch one sketch row after another before they reach the summary.
+*/
+template <typename R_T, typename THETA_T>
+struct HeavyHitterSpace {
+private:
+  using uint32_t = uint;
+  using traits = math_traits<R_T, THETA_T>;
+public:
+  const R_T rStep;
+  const THETA_T thetaStep;
+
+  /*
+   * @param capacity - amount of tracked cells
+   * @param width - counters in a row of the sketch, rounded up to a power of two
+   * @param depth - rows of the sketch
+   * @param seed - seed of the sketch hash functions
+  */
+  HeavyHitterSpace(R_T rStep, THETA_T thetaStep, size_t capacity, size_t width = 1 << 16,
+                   size_t depth = 4, unsigned seed = 0) : rStep(rStep), thetaStep(thetaStep),
+    thetaSize(static_cast<size_t>(static_cast<THETA_T>(2) * traits::pi() / thetaStep) + 2),
+    capacity(std::max<size_t>(capacity, 1)), totalVotes(0), evicted(0),
+    position(this->capacity), blockStart(this->capacity), sketchWidth(1), widthShift(64) {
+    assert(depth > 0);
+    thetaCos.resize(thetaSize);
+    thetaSin.resize(thetaSize);
+    columnRows.resize(thetaSize);
+    columnKeys.resize(thetaSize);
+    columnEstimates.resize(thetaSize);
+    THETA_T thetaStep2 = thetaStep / static_cast<THETA_T>(2);
+    for (size_t i = 0; i < thetaSize; ++i) {
+      thetaCos[i] = static_cast<R_T>(traits::cos(i * thetaStep + thetaStep2));
+      thetaSin[i] = static_cast<R_T>(traits::sin(i * thetaStep + thetaStep2));
+    }
+    while (sketchWidth < width) {
+      sketchWidth <<= 1;
+      --widthShift;
+    }
+    sketch.assign(depth * sketchWidth, 0);
+    std::mt19937_64 gen(seed);
+    for (size_t d = 0; d < depth; ++d) hashes.emplace_back(gen() | 1, gen());
+    entries.reserve(this->capacity);
+  }
+
+  /*
+   * Votes point in every column
+  */
+  void add(const Point<R_T> &p) {
+    binColumns(p.x, p.y, thetaCos.data(), thetaSin.data(), thetaSize, rStep, 0, MAX_ROWS,
+               columnRows.data());
+    size_t hits = 0;
+    for (size_t i = 0; i != thetaSize; ++i) {
+      if (columnRows[i] != NO_ROW) columnKeys[hits++] = static_cast<uint64_t>(columnRows[i]) * thetaSize + i;
+    }
+    countInSketch(hits);
+    for (size_t k = 0; k != hits; ++k) vote(columnKeys[k], columnEstimates[k]);
+  }
+
+  void add(const std::vector<Point<R_T>> &points) {
+    for (const auto &p : points) add(p);
+  }
+
+  /*
+   * Upper bound of the count of cell (r, theta)
+  */
+  uint32_t get(R_T r, THETA_T theta) const {
+    bool ok = true;
+    uint64_t key = keyOf(r, theta, ok);
+    if (!ok) return 0;
+    uint32_t i = position.find(key);
+    uint32_t summary = i != Index::NONE ? entries[i].count : evicted;
+    return std::min(summary, estimate(key));
+  }
+
+  /*
+   * Guaranteed lower bound of the count of cell (r, theta), zero if it is not tracked
+  */
+  uint32_t getLowerBound(R_T r, THETA_T theta) const {
+    bool ok = true;
+    uint64_t key = keyOf(r, theta, ok);
+    if (!ok) return 0;
+    uint32_t i = position.find(key);
+    if (i == Index::NONE) return 0;
+    return entries[i].count - entries[i].error;
+  }
+
+  /*
+   * Up to amount tracked cells with more than one vote, heaviest first
+  */
+  std::vector<Line<R_T, THETA_T>> getLines(uint32_t amount) const {
+    std::vector<Line<R_T, THETA_T>> lines;
+    for (size_t i = 0; i != entries.size() && lines.size() != amount; ++i) {
+      if (entries[i].count <= 1) break;
+      uint64_t row = entries[i].key / thetaSize, column = entries[i].key % thetaSize;
+      lines.emplace_back(row * rStep + rStep / static_cast<R_T>(2),
+                         column * thetaStep + thetaStep / static_cast<THETA_T>(2));
+    }
+    return lines;
+  }
+
+  bool isOnLine(const Line<R_T, THETA_T> &line, const Point<R_T> &p) const {
+    bool ok = true;
+    uint64_t key = keyOf(line.r, line.theta, ok);
+    assert(ok == true);
+    size_t column = key % thetaSize;
+    uint32_t row = NO_ROW;
+    binColumns(p.x, p.y, &thetaCos[column], &thetaSin[column], 1, rStep, 0, MAX_ROWS, &row);
+    return row != NO_ROW && static_cast<uint64_t>(row) * thetaSize + column == key;
+  }
+
+  // amount of votes seen
+  uint64_t votes() const { return totalVotes; }
+
+  /*
+   * Largest overestimate of a count in the summary, at most votes / capacity
+  */
+  uint32_t maxError() const { return evicted; }
+
+private:
+  // rows above this are not voted, r cells have to fit in 32 bit integers of binColumns
+  static const uint32_t MAX_ROWS = 1u << 30;
+
+  // a tracked cell, slot is its slot in position
+  struct Entry {
+    uint64_t key;
+    uint32_t count, error;
+    size_t slot;
+    Entry(uint64_t key) : key(key), count(0), error(0), slot(0) {}
+  };
+
+  /*
+   * Open addressing map of at most capacity keys to positions of the summary, as in
+   * SparseAccumulator: linear probing in a power of two of slots of at least twice the
+   * capacity, so it never grows and slots stay put until an erase. erase shifts the rest of
+   * the probe run back instead of leaving a tombstone, so evictions do not lengthen later
+   * probes, and reports every moved value with its new slot
+  */
+  struct Index {
+    static const uint32_t NONE = ~static_cast<uint32_t>(0);
+
+    explicit Index(size_t capacity) : shift(63) {
+      size_t size = 2;
+      for (; size < 2 * capacity; size <<= 1) --shift;
+      slots.resize(size);
+    }
+
+    uint32_t find(uint64_t key) const {
+      size_t mask = slots.size() - 1;
+      for (size_t i = home(key); ; i = (i + 1) & mask) {
+        if (slots[i].key == key) return slots[i].value;
+        if (slots[i].key == EMPTY) return NONE;
+      }
+    }
+
+    /*
+     * Slot of key, a new one when it is missing
+    */
+    size_t slotOf(uint64_t key) {
+      size_t mask = slots.size() - 1;
+      for (size_t i = home(key); ; i = (i + 1) & mask) {
+        if (slots[i].key == key) return i;
+        if (slots[i].key == EMPTY) {
+          slots[i].key = key;
+          return i;
+        }
+      }
+    }
+
+    uint32_t &value(size_t slot) { return slots[slot].value; }
+
+    uint32_t &at(uint64_t key) { return slots[slotOf(key)].value; }
+
+    template <typename F>
+    void erase(size_t i, F moved) {
+      size_t mask = slots.size() - 1;
+      for (size_t j = (i + 1) & mask; slots[j].key != EMPTY; j = (j + 1) & mask) {
+        // a key can fill the hole if the hole lies between its home slot and j
+        if (((j - home(slots[j].key)) & mask) >= ((j - i) & mask)) {
+          slots[i] = slots[j];
+          moved(slots[i].value, i);
+          i = j;
+        }
+      }
+      slots[i] = Slot();
+    }
+
+    void erase(uint64_t key) {
+      size_t mask = slots.size() - 1;
+      for (size_t i = home(key); slots[i].key != EMPTY; i = (i + 1) & mask) {
+        if (slots[i].key == key) return erase(i, [](uint32_t, size_t) {});
+      }
+    }
+
+  private:
+    static const uint64_t EMPTY = ~static_cast<uint64_t>(0);
+
+    struct Slot {
+      uint64_t key;
+      uint32_t value;
+      Slot() : key(EMPTY), value(NONE) {}
+    };
+
+    // Fibonacci hashing as in SparseAccumulator
+    size_t home(uint64_t key) const {
+      return static_cast<size_t>((key * 0x9e3779b97f4a7c15ull) >> shift);
+    }
+
+    std::vector<Slot> slots;
+    unsigned shift;
+  };
+
+  /*
+   * Counts hits cells of columnKeys in the sketch, a sketch row at a time, and puts their
+   * estimates, this vote included, in columnEstimates
+  */
+  void countInSketch(size_t hits) {
+    totalVotes += hits;
+    std::fill(columnEstimates.begin(), columnEstimates.begin() + hits, ~static_cast<uint32_t>(0));
+    for (size_t d = 0; d != hashes.size(); ++d) {
+      uint32_t *row = &sketch[d * sketchWidth];
+      for (size_t k = 0; k != hits; ++k) {
+        uint32_t c = ++row[hashOf(d, columnKeys[k])];
+        columnEstimates[k] = std::min(columnEstimates[k], c);
+      }
+    }
+  }
+
+  /*
+   * Votes key of sketch estimate once in the summary
+  */
+  void vote(uint64_t key, uint32_t estimate) {
+    // a tracked count never exceeds the estimate, so a cell estimated below the smallest
+    // counter of a full summary is not tracked
+    if (entries.size() == capacity && estimate < entries.back().count) {
+      evicted = std::max(evicted, estimate);
+      return;
+    }
+    uint32_t i = position.find(key);
+    if (i != Index::NONE) {
+      raise(i, entries[i].count + 1);
+      return;
+    }
+    auto last = static_cast<uint32_t>(entries.size());
+    if (last < capacity) {
+      entries.emplace_back(key);
+      blockStart.at(0) = last;
+      entries[last].slot = position.slotOf(key);
+      position.value(entries[last].slot) = last;
+      raise(last, 1);
+      return;
+    }
+    // a cell whose estimate does not exceed the smallest counter would only replace it by
+    // a count no larger: it stays out, its count is at most evicted from now on
+    --last;
+    Entry &e = entries[last];
+    if (estimate <= e.count) {
+      evicted = std::max(evicted, estimate);
+      return;
+    }
+    // Space-Saving: the new cell takes over the smallest counter. Its count was at most the
+    // largest evicted one before this vote, and never more than the sketch estimate
+    position.erase(e.slot, [this](uint32_t i, size_t slot) { entries[i].slot = slot; });
+    evicted = std::max(evicted, e.count);
+    uint32_t count = std::min(evicted + 1, estimate);
+    e.key = key;
+    e.error = count - 1;
+    e.slot = position.slotOf(key);
+    position.value(e.slot) = last;
+    raise(last, count);
+  }
+
+  /*
+   * Raises the counter at position i to count keeping entries sorted by count descending:
+   * the counter is swapped with the first one of its count block and joins the block above
+   * until that block is not below count, so a unit vote is one swap
+  */
+  void raise(uint32_t i, uint32_t count) {
+    while (true) {
+      uint32_t c = entries[i].count;
+      uint32_t &start = blockStart.at(c);
+      uint32_t f = start;
+      if (f != i) {
+        std::swap(entries[i], entries[f]);
+        position.value(entries[i].slot) = i;
+        position.value(entries[f].slot) = f;
+      }
+      if (f + 1 < entries.size() && entries[f + 1].count == c) {
+        start = f + 1;
+      } else {
+        blockStart.erase(c);
+      }
+      i = f;
+      if (f == 0 || entries[f - 1].count >= count) break;
+      entries[f].count = entries[f - 1].count;
+    }
+    entries[i].count = count;
+    if (i == 0 || entries[i - 1].count != count) blockStart.at(count) = i;
+  }
+
+  // multiply-shift hash of key into a row of the sketch
+  size_t hashOf(size_t d, uint64_t key) const {
+    if (widthShift == 64) return 0;
+    return static_cast<size_t>((hashes[d].first * key + hashes[d].second) >> widthShift);
+  }
+
+  uint32_t estimate(uint64_t key) const {
+    uint32_t e = sketch[hashOf(0, key)];
+    for (size_t d = 1; d != hashes.size(); ++d) {
+      e = std::min(e, sketch[d * sketchWidth + hashOf(d, key)]);
+    }
+    return e;
+  }
+
+  /*
+   * Cell of (r, theta), r is binned by the voting kernel itself on a unit column
+  */
+  uint64_t keyOf(R_T r, THETA_T theta, bool &ok) const {
+    const THETA_T full = static_cast<THETA_T>(2) * traits::pi();
+    theta = std::fmod(theta, full);
+    if (theta < 0) theta += full;
+    size_t column = std::min(thetaSize - 1, static_cast<size_t>(theta / thetaStep));
+    const R_T one = 1, zero = 0;
+    uint32_t row = NO_ROW;
+    binColumns(r, zero, &one, &zero, 1, rStep, 0, MAX_ROWS, &row);
+    ok = row != NO_ROW;
+    return static_cast<uint64_t>(row) * thetaSize + column;
+  }
+
+  const size_t thetaSize, capacity;
+  uint64_t totalVotes;
+  // largest count taken over from an evicted cell, bounds the count of any untracked cell
+  uint32_t evicted;
+  std::vector<R_T> thetaCos, thetaSin;
+  std::vector<uint32_t> columnRows;
+  // cells of the point being added and their sketch estimates
+  std::vector<uint64_t> columnKeys;
+  std::vector<uint32_t> columnEstimates;
+  // summary sorted by count descending, position of every tracked key and first position of
+  // every count present
+  std::vector<Entry> entries;
+  Index position, blockStart;
+  // depth rows of the sketch one after another, and (multiplier, addend) of every row
+  std::vector<uint32_t> sketch;
+  std::vector<std::pair<uint64_t, uint64_t>> hashes;
+  size_t sketchWidth;
+  unsigned widthShift;
+};
+
+template <typename R_T, typename THETA_T>
+const uint32_t HeavyHitterSpace<R_T, THETA_T>::MAX_ROWS;
+
+template <typename R_T, typename THETA_T>
+const uint32_t HeavyHitterSpace<R_T, THETA_T>::Index::NONE;
+
+template <typename R_T, typename THETA_T>
+const uint64_t HeavyHitterSpace<R_T, THETA_T>::Index::EMPTY;
+
+#endif // HEAVY_HITTER_SPACE_H
@@ -0,0 +1,43 @@
+#include "hough_transform.h"
+#include "kernels.h"
+
+// GCC clones these functions for every listed instruction set and dispatches through ifunc
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define KERNEL_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#define KERNEL_TARGETS
+#endif
+
+KERNEL_TARGETS
+void binColumns(float x, float y, const float *cs, const float *sn, size_t n, float step,
+                uint32_t offset, uint32_t rows, uint32_t *out) {
+  binColumns<float>(x, y, cs, sn, n, step, offset, rows, out);
+}
+
+KERNEL_TARGETS
+void binColumns(double x, double y, const double *cs, const double *sn, size_t n, double step,
+                uint32_t offset, uint32_t rows, uint32_t *out) {
+  binColumns<double>(x, y, cs, sn, n, step, offset, rows, out);
+}
+
+KERNEL_TARGETS
+void addCounters(uint8_t *dst, const uint8_t *src, size_t n) {
+  addCounters<uint8_t, uint8_t>(dst, src, n);
+}
+
+KERNEL_TARGETS
+void addCounters(uint16_t *dst, const uint16_t *src, size_t n) {
+  addCounters<uint16_t, uint16_t>(dst, src, n);
+}
+
+KERNEL_TARGETS
+void addCounters(uint32_t *dst, const uint32_t *src, size_t n) {
+  addCounters<uint32_t, uint32_t>(dst, src, n);
+}
+
+template struct HoughTransformer2d<float, float>;
+template struct HoughTransformer2d<double, double>;
+template struct HoughSpace<float, float>;
+template struct HoughSpace<double, double>;
+template struct PartialHoughSpace<float, float>;
+template struct PartialHoughSpace<double, double>;
@@ -2,44 +2,569 @@
 #define HOUGH_TRANSFORM_H
 
 #include "utils.h"
+#include "space_filling_curve.h"
+#include "kernels.h"
+#include "sparse_accumulator.h"
+#include "accumulator.h"
 #include <vector>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <queue>
+#include <limits>
 
 template <typename R_T, typename THETA_T>
 struct HoughSpace;
 
+template <typename R_T, typename THETA_T>
+struct FastHoughTransformer;
+
+template <typename R_T, typename THETA_T>
+struct RadonTransformer;
+
+template <typename R_T, typename THETA_T>
+struct PartialHoughSpace;
+
+template <typename R_T, typename THETA_T>
+struct OutOfCoreHoughSpace;
+
+template <typename R_T, typename THETA_T>
+struct SpaceFile;
+
+/*
+ * Storage of the accumulator. Dense is a counter for every cell, Sparse keeps only the hit
+ * cells in a hash map (see SparseAccumulator), Auto picks Sparse when the space is large and
+ * the points can hit only a small part of it.
+*/
+enum class SpaceStorage { Auto, Dense, Sparse };
+
+/*
+ * How a space keeps its counters
+ * @field sparse - counters in a hash map
+ * @field layout - order of cells in the dense buffer
+ * @field width - bytes per dense counter, 1, 2 or 4. Counters are widened when a count
+ *  could exceed them
+ * @field backing - memory of the dense counters: lazy or huge pages, a file or a memory
+ *  resource. The resource also serves the hashed counters, the head, trigonometry and
+ *  scratch tables of the space and temporaries of getLines
+*/
+struct SpaceFormat {
+  bool sparse;
+  Layout layout;
+  unsigned width;
+  Backing backing;
+  SpaceFormat() : sparse(false), layout(Layout::RowMajor), width(4) {}
+};
+
+/*
+ * Read-only counters of a space in place together with the heads of its cells: row i is
+ * the r cell with head r[i] and column j the theta cell with head theta[j], rows and columns
+ * count the two extra ones of a space, whose heads are zero. Nothing is copied, so the view
+ * can be handed to other libraries as a strided 2D array
+*/
+template <typename T, typename R_T, typename THETA_T>
+struct HoughSpaceView : SpaceView<T> {
+  const R_T *r;
+  const THETA_T *theta;
+
+  HoughSpaceView(const SpaceView<T> &counters, const R_T *r, const THETA_T *theta) :
+    SpaceView<T>(counters), r(r), theta(theta) {}
+};
+
+/*
+ * Region of interest of a transform, only cells inside of it are allocated and voted.
+ * Theta intervals [from, to] are taken modulo 2 * pi, from > to wraps through zero.
+ * No theta intervals means all angles.
+*/
+template <typename R_T, typename THETA_T>
+struct Region {
+  std::vector<std::pair<THETA_T, THETA_T>> thetas;
+  R_T rFrom, rTo;
+
+  Region() : rFrom(0), rTo(std::numeric_limits<R_T>::max()) {}
+
+  Region &addTheta(THETA_T from, THETA_T to) {
+    THETA_T full = static_cast<THETA_T>(2) * math_traits<R_T, THETA_T>::pi();
+    if (to - from >= full) {
+      thetas.emplace_back(0, full);
+    } else {
+      thetas.emplace_back(normalize(from), normalize(to));
+    }
+    return *this;
+  }
+
+  Region &setR(R_T from, R_T to) {
+    rFrom = from;
+    rTo = to;
+    return *this;
+  }
+
+  bool isFull() const {
+    return thetas.empty() && (rFrom <= 0) && (rTo == std::numeric_limits<R_T>::max());
+  }
+
+  bool containsTheta(THETA_T theta) const {
+    if (thetas.empty()) return true;
+    theta = normalize(theta);
+    for (const auto &t : thetas) {
+      if (t.first <= t.second ? (t.first <= theta && theta <= t.second)
+                              : (t.first <= theta || theta <= t.second)) return true;
+    }
+    return false;
+  }
+
+private:
+  static THETA_T normalize(THETA_T theta) {
+    THETA_T full = static_cast<THETA_T>(2) * math_traits<R_T, THETA_T>::pi();
+    theta = std::fmod(theta, full);
+    return theta < 0 ? theta + full : theta;
+  }
+};
+
 template <typename R_T, typename THETA_T>
 struct HoughTransformer2d {
 private:
   using uint32_t = uint;
   using traits = math_traits<R_T, THETA_T>;
 public:
-  HoughTransformer2d(R_T rStep, THETA_T thetaStep) : rStep(rStep), thetaStep(thetaStep) {}
+  HoughTransformer2d(R_T rStep, THETA_T thetaStep,
+                     const Region<R_T, THETA_T> &region = Region<R_T, THETA_T>()) :
+    rStep(rStep), thetaStep(thetaStep), region(region), pointOrder(PointOrder::Input),
+    storage(SpaceStorage::Auto), layout(Layout::RowMajor), counterWidth(0),
+    lazyPages(false), hugePages(false), resource(heapResource()), maxR(0) {}
+
+  /*
+   * Transformer over a non-uniform theta grid
+   * @param thetas - sorted samples in [0, 2 * pi), every sample owns the angles closer to it
+   *  than to its neighbours
+  */
+  HoughTransformer2d(R_T rStep, const std::vector<THETA_T> &thetas,
+                     const Region<R_T, THETA_T> &region = Region<R_T, THETA_T>()) :
+    rStep(rStep), thetaStep(static_cast<THETA_T>(2) * traits::pi() / thetas.size()),
+    region(region), thetas(thetas), pointOrder(PointOrder::Input), storage(SpaceStorage::Auto),
+    layout(Layout::RowMajor), counterWidth(0), lazyPages(false), hugePages(false),
+    resource(heapResource()), maxR(0) {
+    assert(!thetas.empty() && std::is_sorted(thetas.begin(), thetas.end()));
+  }
+
+  /*
+   * Sorts points along a space-filling curve before voting in transform, results do not
+   * depend on the order, only memory locality of voting does
+  */
+  HoughTransformer2d &setPointOrder(PointOrder order) {
+    pointOrder = order;
+    return *this;
+  }
+
+  HoughTransformer2d &setStorage(SpaceStorage s) {
+    storage = s;
+    return *this;
+  }
+
+  HoughTransformer2d &setLayout(Layout l) {
+    layout = l;
+    return *this;
+  }
+
+  /*
+   * Bytes of a dense counter to start with, 1, 2 or 4; 0 picks the narrowest one for the
+   * total of votes
+  */
+  HoughTransformer2d &setCounterWidth(unsigned bytes) {
+    counterWidth = bytes;
+    return *this;
+  }
+
+  /*
+   * Dense spaces map their counters without zeroing them, pages are allocated on the first
+   * vote and untouched ones are skipped by scans. Suits large spaces voted in a small part,
+   * e.g. by a narrow region or few points
+  */
+  HoughTransformer2d &setLazyPages(bool lazy) {
+    lazyPages = lazy;
+    return *this;
+  }
+
+  /*
+   * Dense counters on 2 MiB pages: explicit huge pages when reserved, transparent ones
+   * otherwise, regular pages when neither is available. Cuts TLB misses of voting into
+   * spaces of hundreds of megabytes
+  */
+  HoughTransformer2d &setHugePages(bool huge) {
+    hugePages = huge;
+    return *this;
+  }
+
+  /*
+   * Memory of the spaces made from now on (dense counters kept in memory, hashed counters
+   * and the tables of a space, temporaries of getLines) and of the point orders of
+   * transforms, e.g. a MonotonicArena per thread released at the end of every frame once
+   * its spaces are gone. Results such as those of getSpace and getLines and the theta cells
+   * of a region stay on the C heap. Null restores the C heap
+  */
+  HoughTransformer2d &setMemoryResource(MemoryResource *r) {
+    resource = r != nullptr ? r : heapResource();
+    return *this;
+  }
+
+  /*
+   * Distance the rows of spaces cover whatever the points are, 0 takes it from the farthest
+   * point. Transforms of shards of a point set with the maxR of the whole set make spaces of
+   * one grid, which HoughSpace::merge sums into the space of the whole set
+  */
+  HoughTransformer2d &setMaxR(R_T r) {
+    maxR = r;
+    return *this;
+  }
 
   HoughSpace<R_T, THETA_T> transform(const std::vector<Point<R_T>> &points) const {
+    HoughSpace<R_T, THETA_T> space = makeSpace(points);
+    if (pointOrder == PointOrder::Input) {
+      for (const auto &p : points) space.vote(p);
+      return space;
+    }
+    for (size_t j : curveOrder(points, pointOrder, scratch())) space.vote(points[j]);
+    return space;
+  }
+
+  /*
+   * Transform into a space made by this transformer before, reusing its memory: the counters
+   * are cleared in place and reallocated only when the extent of points outgrows them, the
+   * theta tables are kept. A stream of frames of similar extent then runs without heap
+   * allocations, except for the sort of a space-filling curve point order, which is taken
+   * from the memory resource when one is set.
+   * The result equals that of transform(points)
+  */
+  void transformInto(const std::vector<Point<R_T>> &points,
+                     HoughSpace<R_T, THETA_T> &space) const {
+    assert(space.rStep == rStep && space.thetaStep == thetaStep);
+    size_t rFirst = 0, rSize = 0;
+    rowRange(points, rFirst, rSize);
+    space.reshape(rFirst, rSize, formatOf(points.size(), points.size(), rSize, space.thetaSize));
+    if (pointOrder == PointOrder::Input) {
+      for (const auto &p : points) space.vote(p);
+      return;
+    }
+    for (size_t j : curveOrder(points, pointOrder, scratch())) space.vote(points[j]);
+  }
+
+  /*
+   * Weighted voting: each point adds its weight to the cells instead of one,
+   * e.g. pixel intensities of a grayscale image
+  */
+  HoughSpace<R_T, THETA_T> transform(const std::vector<Point<R_T>> &points,
+                                     const std::vector<uint32_t> &weights) const {
+    assert(points.size() == weights.size());
+    uint64_t votes = 0;
+    for (uint32_t w : weights) votes += w;
+    HoughSpace<R_T, THETA_T> space = makeSpace(points, votes);
+    for (size_t j : curveOrder(points, pointOrder, scratch())) space.vote(points[j], weights[j]);
+    return space;
+  }
+
+  /*
+   * Anytime transform: votes points in stratified random order until the deadline.
+   * Any prefix of that order covers the whole point set evenly, so a partial space is a
+   * scaled-down sample of the full one and getLines on it is still meaningful.
+   * The clock is read once per a few thousand votes.
+   * @param seed - seed of the voting order, same seed gives the same result
+  */
+  PartialHoughSpace<R_T, THETA_T> transformUntil(const std::vector<Point<R_T>> &points,
+                                                 std::chrono::steady_clock::time_point deadline,
+                                                 unsigned seed = 0) const {
+    HoughSpace<R_T, THETA_T> space = makeSpace(points);
+    ResourceVector<size_t> order = stratifiedOrder(points, seed);
+    size_t checkEvery = std::max<size_t>(1, 4096 / std::max<size_t>(1, space.thetaSize));
+    size_t voted = 0;
+    while (voted != order.size()) {
+      if (voted % checkEvery == 0 && std::chrono::steady_clock::now() >= deadline) break;
+      space.vote(points[order[voted]]);
+      ++voted;
+    }
+    return PartialHoughSpace<R_T, THETA_T>(std::move(space), voted, points.size());
+  }
+
+  /*
+   * Transform with early termination for getLines(amount): points are voted in stratified
+   * random order, and the amount + 1 leading cells are followed as they are voted. Voting
+   * stops when either the gap between the amount-th and the next cell exceeds the remaining
+   * points, or an empirical Bernstein bound on their per point difference (with finite
+   * population correction and union bound over all cells) separates their final counts with
+   * probability at least 1 - delta.
+   * Counts only grow, so the leading cells change only when a voted cell passes the last of
+   * them, and both rules are checked after every point without a scan of the space. Reading
+   * back the cells of every point costs a part of a vote, so once the rates of the two cells
+   * seen so far would not stop voting before the last eighth of the points, the rest is
+   * voted as by transform.
+   * Only the set of top cells is guaranteed, counts in the space are those of the voted prefix.
+  */
+  PartialHoughSpace<R_T, THETA_T> transformTop(const std::vector<Point<R_T>> &points,
+                                               size_t amount, double delta = 1e-3,
+                                               unsigned seed = 0) const {
+    HoughSpace<R_T, THETA_T> space = makeSpace(points);
+    ResourceVector<size_t> order = stratifiedOrder(points, seed);
+    size_t n = points.size();
+    double logTerm = std::log(2 * static_cast<double>(space.rows * space.columns) / delta);
+    // counts and keys of the amount + 1 cells of the largest counts, by count descending; a
+    // cell out of them holds at most the last count, and enters when a vote passes it
+    std::vector<uint32_t> counts(amount + 1, 0);
+    std::vector<uint64_t> keys(amount + 1, std::numeric_limits<uint64_t>::max());
+    auto follow = [&counts, &keys, amount](uint64_t key, uint32_t c) {
+      size_t k = 0;
+      while (k != amount && keys[k] != key) ++k;
+      for (; k != 0 && counts[k - 1] < c; --k) {
+        counts[k] = counts[k - 1];
+        keys[k] = keys[k - 1];
+      }
+      counts[k] = c;
+      keys[k] = key;
+      return counts[amount];
+    };
+    // the rates are projected after every sixteenth of the points
+    size_t checkEvery = std::max<size_t>(64, n / 16);
+    bool following = amount != 0;
+    size_t voted = 0;
+    while (voted != n) {
+      if (!following) {
+        space.vote(points[order[voted++]]);
+        continue;
+      }
+      space.voteFollowing(points[order[voted++]], counts[amount], follow);
+      // getLines takes cells of more than one vote
+      uint32_t kth = counts[amount - 1] > 1 ? counts[amount - 1] : 0;
+      uint32_t next = counts[amount] > 1 ? counts[amount] : 0;
+      if (kth > next) {
+        if (kth - next > n - voted) break;
+        double pk = static_cast<double>(kth) / voted, pn = static_cast<double>(next) / voted;
+        if (separated(pk, pn, voted, n, logTerm)) break;
+      }
+      if (voted % checkEvery == 0) following = stopsEarly(kth, next, voted, n, logTerm);
+    }
+    return PartialHoughSpace<R_T, THETA_T>(std::move(space), voted, n);
+  }
+
+private:
+
+  /*
+   * Bernstein rule of transformTop for the amount-th and the next cell, which got rates pk
+   * and pn of the first voted of n points
+  */
+  static bool separated(double pk, double pn, size_t voted, size_t n, double logTerm) {
+    // per point difference of the two cells lies in [-1, 1]
+    double gap = pk - pn, variance = std::max(0.0, pk + pn - gap * gap);
+    double correction = 1 - static_cast<double>(voted - 1) / n;
+    double eps = std::sqrt(2 * variance * correction * logTerm / voted) +
+                 14 * logTerm / (3 * (voted - 1));
+    return gap > eps;
+  }
+
+  /*
+   * Whether the amount-th and the next cell of transformTop, counted kth and next by the
+   * first voted of n points, would stop it at their rates before the last eighth of the points
+  */
+  static bool stopsEarly(uint32_t kth, uint32_t next, size_t voted, size_t n, double logTerm) {
+    if (kth <= next) return false;
+    double pk = static_cast<double>(kth) / voted, pn = static_cast<double>(next) / voted;
+    size_t last = n - n / 8;
+    return (pk - pn) * last > static_cast<double>(n - last) ||
+           separated(pk, pn, last, n, logTerm);
+  }
+
+  /*
+   * Order of points in which every prefix is a proportionally stratified sample: points are
+   * bucketed by a coarse grid over their bounding box, shuffled inside buckets, and the points
+   * of every bucket are spread evenly over the whole order (systematic sampling), so dense
+   * structures keep their share of votes in any prefix.
+  */
+  ResourceVector<size_t> stratifiedOrder(const std::vector<Point<R_T>> &points,
+                                         unsigned seed) const {
+    ResourceVector<size_t> order(points.size(), 0, scratch());
+    if (points.empty()) return order;
+    R_T minX = points[0].x, maxX = points[0].x, minY = points[0].y, maxY = points[0].y;
+    for (const auto &p : points) {
+      minX = std::min(minX, p.x);
+      maxX = std::max(maxX, p.x);
+      minY = std::min(minY, p.y);
+      maxY = std::max(maxY, p.y);
+    }
+    size_t grid = 1;
+    while (grid < 64 && grid * grid * 16 < points.size()) ++grid;
+    R_T cellX = (maxX - minX) / grid, cellY = (maxY - minY) / grid;
+    auto bucketOf = [&](R_T v, R_T lo, R_T cell) {
+      if (!(cell > 0)) return size_t(0);
+      return std::min(grid - 1, static_cast<size_t>((v - lo) / cell));
+    };
+    // points bucket by bucket, in input order inside a bucket
+    ResourceVector<size_t> bucket(points.size(), 0, scratch());
+    ResourceVector<size_t> start(grid * grid + 1, 0, scratch());
+    for (size_t i = 0; i != points.size(); ++i) {
+      const auto &p = points[i];
+      bucket[i] = bucketOf(p.y, minY, cellY) * grid + bucketOf(p.x, minX, cellX);
+      ++start[bucket[i] + 1];
+    }
+    for (size_t b = 0; b != grid * grid; ++b) start[b + 1] += start[b];
+    ResourceVector<size_t> sorted(points.size(), 0, scratch());
+    ResourceVector<size_t> fill(start.begin(), start.end() - 1, scratch());
+    for (size_t i = 0; i != points.size(); ++i) sorted[fill[bucket[i]]++] = i;
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> offset(0, 1);
+    using key_t = std::pair<double, size_t>;
+    ResourceVector<key_t> keyed(points.size(), key_t(), scratch());
+    for (size_t b = 0; b != grid * grid; ++b) {
+      size_t first = start[b], size = start[b + 1] - first;
+      std::shuffle(sorted.begin() + first, sorted.begin() + first + size, gen);
+      double u = offset(gen);
+      for (size_t k = 0; k != size; ++k) keyed[first + k] = {(k + u) / size, sorted[first + k]};
+    }
+    // keys in [0, 1) are spread evenly, so a counting sort by n slots leaves a few per slot
+    size_t n = points.size();
+    ResourceVector<size_t> slot(n + 1, 0, scratch());
+    for (const auto &k : keyed) ++slot[std::min(n - 1, static_cast<size_t>(k.first * n)) + 1];
+    for (size_t i = 0; i != n; ++i) slot[i + 1] += slot[i];
+    ResourceVector<key_t> byKey(n, key_t(), scratch());
+    for (const auto &k : keyed) byKey[slot[std::min(n - 1, static_cast<size_t>(k.first * n))]++] = k;
+    for (size_t i = 0, first = 0; i != n; first = slot[i++]) {
+      std::sort(byKey.begin() + first, byKey.begin() + slot[i]);
+    }
+    for (size_t i = 0; i != n; ++i) order[i] = byKey[i].second;
+    return order;
+  }
+
+  // allocator of the temporaries of a transform, they come from the memory resource
+  ResourceAllocator<size_t> scratch() const { return ResourceAllocator<size_t>(resource); }
+
+  /*
+   * @param votes - total weight to be voted, any count stays below it. Zero means one vote
+   *  per point
+  */
+  HoughSpace<R_T, THETA_T> makeSpace(const std::vector<Point<R_T>> &points,
+                                     uint64_t votes = 0) const {
+    if (votes == 0) votes = points.size();
     auto sizeTheta = static_cast<size_t>(static_cast<THETA_T>(2) * traits::pi() / thetaStep) + 2;
-    R_T maxR = 0;
+    size_t rFirst = 0, sizeR = 0;
+    rowRange(points, rFirst, sizeR);
+    if (region.isFull() && thetas.empty()) {
+      return HoughSpace<R_T, THETA_T>(rStep, thetaStep, sizeR, sizeTheta,
+                                      formatOf(points.size(), votes, sizeR, sizeTheta));
+    }
+    size_t rLast = rFirst + sizeR;
+    std::vector<size_t> thetaCells;
+    if (!thetas.empty()) {
+      for (size_t i = 0; i != thetas.size(); ++i) {
+        if (region.containsTheta(thetas[i])) thetaCells.push_back(i);
+      }
+      return HoughSpace<R_T, THETA_T>(rStep, thetas, rFirst, rLast - rFirst, thetaCells,
+                                      formatOf(points.size(), votes, rLast - rFirst,
+                                               thetaCells.size()));
+    }
+    THETA_T thetaStep2 = thetaStep / static_cast<THETA_T>(2);
+    for (size_t i = 0; i != sizeTheta; ++i) {
+      if (region.containsTheta(i * thetaStep + thetaStep2)) thetaCells.push_back(i);
+    }
+    return HoughSpace<R_T, THETA_T>(rStep, thetaStep, rFirst, rLast - rFirst, thetaCells,
+                                    formatOf(points.size(), votes, rLast - rFirst,
+                                             thetaCells.size()));
+  }
+
+  /*
+   * Rows of the space for points: rSize rows from r cell rFirst, covering every distance of
+   * a point, or maxR when it is set, with a margin and clipped to the r cells of the region,
+   * those whose head is in [rFrom, rTo] as for theta cells
+  */
+  void rowRange(const std::vector<Point<R_T>> &points, size_t &rFirst, size_t &rSize) const {
+    R_T farthest = 0;
     for (const auto &p : points) {
       R_T sqr = p.x * p.x + p.y * p.y;
-      maxR = std::max(sqr, maxR);
+      farthest = std::max(sqr, farthest);
     }
-    maxR = traits::sqrt(maxR);
-    size_t sizeR = static_cast<size_t>(maxR / rStep) + 10;
-    HoughSpace<R_T, THETA_T> space(rStep, thetaStep, sizeR, sizeTheta);
-    for (const auto &p : points) {
-      for (size_t i = 0; i != sizeTheta; ++i) {
-        R_T r = space.getR(p, i);
-        space.update(r, i);
-      }
+    farthest = maxR > 0 ? maxR : traits::sqrt(farthest);
+    size_t sizeR = static_cast<size_t>(farthest / rStep) + 10;
+    const R_T half = static_cast<R_T>(0.5);
+    R_T first = std::ceil(std::max<R_T>(region.rFrom / rStep - half, 0));
+    rFirst = first < static_cast<R_T>(sizeR) ? static_cast<size_t>(first) : sizeR;
+    size_t rLast = sizeR;
+    if (region.rTo / rStep - half < static_cast<R_T>(sizeR)) {
+      R_T last = std::floor(region.rTo / rStep - half) + 1;
+      rLast = last > static_cast<R_T>(rFirst) ? static_cast<size_t>(last) : rFirst;
     }
-    return space;
+    rSize = rLast - rFirst;
   }
 
-private:
+  /*
+   * Counters are as narrow as the total of votes allows: most frames have less than 65536
+   * points, so 16 bit counters halve the memory traffic of voting and scans
+  */
+  SpaceFormat formatOf(size_t points, uint64_t votes, size_t rSize, size_t thetaSize) const {
+    SpaceFormat format;
+    format.sparse = isSparse(points, rSize, thetaSize);
+    format.layout = layout;
+    format.width = counterWidth != 0 ? counterWidth : Accumulator::widthFor(votes);
+    format.backing.lazy = lazyPages;
+    format.backing.huge = hugePages;
+    format.backing.resource = resource;
+    return format;
+  }
+
+  /*
+   * Storage choice for Auto: every point hits at most one cell per column, so
+   * points * columns bounds the occupied cells. A hashed cell takes the memory of eight dense
+   * ones (16 byte slot at load below 1/2) and a hashed vote is a cache miss while zeroing
+   * dense cells streams, so Sparse is picked below 1/32 of estimated occupancy, and only
+   * for spaces larger than a few megabytes.
+  */
+  bool isSparse(size_t points, size_t rSize, size_t thetaSize) const {
+    if (storage != SpaceStorage::Auto) return storage == SpaceStorage::Sparse;
+    double cells = static_cast<double>(rSize + 2) * (thetaSize + 2);
+    double votes = static_cast<double>(points) * thetaSize;
+    return cells * sizeof(uint32_t) > (32 << 20) && 32 * votes < cells;
+  }
 
   const R_T rStep;
   const THETA_T thetaStep;
+  const Region<R_T, THETA_T> region;
+  // samples of a non-uniform theta grid, empty for the regular one
+  const std::vector<THETA_T> thetas;
+  PointOrder pointOrder;
+  SpaceStorage storage;
+  Layout layout;
+  unsigned counterWidth;
+  bool lazyPages, hugePages;
+  MemoryResource *resource;
+  // distance covered by the rows of spaces, 0 for that of the farthest point
+  R_T maxR;
 };
 
+/*
+ * Non-uniform theta grid of amount samples in [0, 2 * pi), placed by inverting the cumulative
+ * distribution of density (any non-negative function of theta, it does not need to be
+ * normalized), so resolution goes where density is high.
+*/
+template <typename THETA_T, typename F>
+std::vector<THETA_T> densityThetaGrid(size_t amount, F density) {
+  const THETA_T full = static_cast<THETA_T>(2) * math_traits<THETA_T, THETA_T>::pi();
+  size_t fine = 64 * std::max<size_t>(amount, 1);
+  THETA_T step = full / fine;
+  std::vector<double> cdf(fine + 1, 0);
+  for (size_t j = 0; j != fine; ++j) {
+    double d = density((j + static_cast<THETA_T>(0.5)) * step);
+    cdf[j + 1] = cdf[j] + std::max(0.0, d);
+  }
+  std::vector<THETA_T> thetas(amount);
+  if (!(cdf[fine] > 0)) {
+    for (size_t k = 0; k != amount; ++k) thetas[k] = (k + static_cast<THETA_T>(0.5)) * full / amount;
+    return thetas;
+  }
+  size_t j = 0;
+  for (size_t k = 0; k != amount; ++k) {
+    double target = (k + 0.5) / amount * cdf[fine];
+    while (cdf[j + 1] < target) ++j;
+    double part = (target - cdf[j]) / (cdf[j + 1] - cdf[j]);
+    thetas[k] = static_cast<THETA_T>((j + part) * step);
+  }
+  return thetas;
+}
+
 template <typename R_T, typename THETA_T>
 struct HoughSpace {
   const R_T rStep;
@@ -51,25 +576,65 @@ struct HoughSpace {
     bool ok = true;
     Cell cell = getCell(r, theta, ok);
     if (!ok) return 0;
-    return space[cell.rTimes][cell.thetaTimes];
+    return count(cell.rTimes, cell.thetaTimes);
+  }
+
+  space_t getSpace() const {
+    space_t dense(rows, std::vector<uint32_t>(columns, 0));
+    forEachCount([&dense](size_t row, size_t column, uint32_t c) { dense[row][column] = c; });
+    return dense;
   }
-  space_t getSpace() const { return space; }
 
+  /*
+   * Counters of a dense space in place with the heads of rows and columns, an alternative
+   * to the copy of getSpace. Valid while the space lives and is not voted or reshaped again;
+   * the counters are null for a sparse or tiled space or when T is not of counterWidth bytes
+  */
+  template <typename T = uint32_t>
+  HoughSpaceView<T, R_T, THETA_T> view() const {
+    SpaceView<T> counters = sparse ? SpaceView<T>{nullptr, rows, columns, 0, 0}
+                                   : space.view<T>();
+    return HoughSpaceView<T, R_T, THETA_T>(counters, rHead.data(), thetaHead.data());
+  }
+
+  // bytes per counter
+  unsigned counterWidth() const { return sparse ? sizeof(uint32_t) : space.width; }
+
+  // counters are kept in a hash map, see SpaceStorage
+  bool isSparse() const { return sparse; }
+
+  /*
+   * Up to amount cells with more than one vote, by count descending and ties by cell in
+   * row by row order descending, so the result does not depend on the storage order.
+   * The scan keeps only the best amount cells in a heap, taken from the memory resource
+   * of the space
+  */
   std::vector<Line<R_T, THETA_T>> getLines(uint32_t amount) const {
-    std::multiset<Node> lines;
-    for (size_t rt = 0; rt < space.size(); ++rt) {
-      for (size_t thetat = 0; thetat < space[0].size(); ++thetat) {
-//        if ((rt == 0) && (thetat * thetaStep) >= math_traits<R_T, THETA_T>::pi()) continue;
-        R_T liner = rHead[rt];
-        THETA_T linetheta = thetaHead[thetat];
-        if (space[rt][thetat] > 1) lines.emplace(space[rt][thetat], Line<R_T, THETA_T>(liner,
-              linetheta));
-      }
+    // (count, row * columns + column), the smallest on top
+    using node_t = std::pair<uint32_t, size_t>;
+    using nodes_t = std::vector<node_t, ResourceAllocator<node_t>>;
+    ResourceAllocator<node_t> scratch(space.memoryResource());
+    std::priority_queue<node_t, nodes_t, std::greater<node_t>> top(scratch);
+    if (amount != 0) {
+      forEachCount([&](size_t rt, size_t thetat, uint32_t c) {
+//        if ((rt == 0) && (thetat * thetaStep) >= math_traits<R_T, THETA_T>::pi()) return;
+        if (c <= 1) return;
+        node_t node(c, rt * columns + thetat);
+        if (top.size() < amount) {
+          top.push(node);
+        } else if (top.top() < node) {
+          top.pop();
+          top.push(node);
+        }
+      });
     }
+    nodes_t nodes(scratch);
+    nodes.reserve(top.size());
+    for (; !top.empty(); top.pop()) nodes.push_back(top.top());
     std::vector<Line<R_T, THETA_T>> amountLines;
-    uint32_t cnt = 0;
-    for (auto it = lines.rbegin(); (it != lines.rend()) && (cnt != amount); ++it, ++cnt) {
-      amountLines.emplace_back(std::move(it->line));
+    amountLines.reserve(nodes.size());
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+      amountLines.emplace_back(rHead[it->second / columns], thetaHead[it->second % columns]);
     }
     return amountLines;
   }
@@ -78,17 +643,91 @@ struct HoughSpace {
     bool ok = true;
     Cell cellLine = getCell(line.r, line.theta, ok);
     assert(ok == true);
-    size_t cell_theta = getCellComponent(line.theta, thetaStep, ok);
-    R_T r = this->getR(p, cell_theta);
-    Cell cellLine1 = getCell(r, line.theta, ok);
+    R_T r = this->getR(p, cellLine.thetaTimes);
+    size_t row = getRow(r, ok);
     if (!ok) return false;
-    return cellLine == cellLine1;
+    return cellLine.rTimes == row;
+  }
+
+  /*
+   * Adds the counts of rhs, a space of the same steps and theta cells whose rows are
+   * among those of this one, e.g. the space of a shard of points made with the maxR of
+   * the whole set (see HoughTransformer2d::setMaxR). Rows are aligned by r cell, so the sum
+   * of the spaces of all shards equals the space of all points. Dense spaces of one layout
+   * are summed a block of counters at a time by the addCounters kernel, dense spaces of
+   * another layout a square of cells at a time, sparse ones cell by cell. The two extra
+   * rows of rhs are left out
+   * @return false if the grids differ, the space is unchanged then
+  */
+  bool merge(const HoughSpace &rhs) {
+    if (rStep != rhs.rStep || thetaStep != rhs.thetaStep || thetaHead != rhs.thetaHead ||
+        thetaColumn != rhs.thetaColumn || thetaSamples != rhs.thetaSamples ||
+        rhs.rOffset < rOffset || rhs.rOffset + rhs.rSize > rOffset + rSize) return false;
+    if (&rhs == this) return merge(HoughSpace(rhs));
+    size_t shift = rhs.rOffset - rOffset;
+    if (sparse || rhs.sparse || space.isLazy()) {
+      rhs.forEachCount([&](size_t row, size_t column, uint32_t c) {
+        if (c != 0 && row < rhs.rSize) update(row + shift, column, c);
+      });
+      return true;
+    }
+    bound += rhs.bound;
+    space.fit(bound);
+    switch (space.width) {
+      case 1: addDense<uint8_t>(rhs, shift); break;
+      case 2: addDense<uint16_t>(rhs, shift); break;
+      default: addDense<uint32_t>(rhs, shift);
+    }
+    return true;
+  }
+
+  // merge of a space of the same grid
+  HoughSpace &operator+=(const HoughSpace &rhs) {
+    bool merged = merge(rhs);
+    assert(merged);
+    (void) merged;
+    return *this;
+  }
+
+  /*
+   * Votes points into the space with the binning of the transform that made it
+   * @return false if a point has a cell beyond the last of the rSize rows, e.g. it is
+   *  farther from the origin than the points of the transform and maxR was not set; no
+   *  point is added then
+  */
+  bool addPoints(const std::vector<Point<R_T>> &points, uint32_t weight = 1) {
+    for (const auto &p : points) {
+      if (!covers(p)) return false;
+    }
+    for (const auto &p : points) vote(p, weight);
+    return true;
+  }
+
+  /*
+   * Takes back votes of points added before, e.g. misclassified ones, in
+   * O(points * columns) instead of a transform of the corrected set: every point removes
+   * weight from the cell voting gave it in every column, so adding and then removing points
+   * restores the counts exactly. Counters never wrap below zero
+   * @return false if a counter would, i.e. a point was not voted with weight; the space is
+   *  unchanged then
+  */
+  bool removePoints(const std::vector<Point<R_T>> &points, uint32_t weight = 1) {
+    for (size_t k = 0; k != points.size(); ++k) {
+      if (unvote(points[k], weight)) continue;
+      // points before k are voted back with the same binning, counters are wide enough
+      for (size_t j = 0; j != k; ++j) {
+        binRows(points[j]);
+        addRows(weight);
+      }
+      return false;
+    }
+    return true;
   }
 
 private:
 
   R_T getR(const Point<R_T> &p, size_t cell_theta) const {
-    return ::getR(p, thetaHead[cell_theta]);
+    return p.x * thetaCos[cell_theta] + p.y * thetaSin[cell_theta];
   }
 
   struct Cell {
@@ -110,8 +749,17 @@ private:
       return 0;
     }
     ok = true;
+    return cellOf(x, step);
+  }
+
+  /*
+   * Cell of non-negative x, a cell index converted to T is integral already,
+   * so it is not rounded again
+  */
+  template <typename T>
+  static size_t cellOf(T x, const T step) {
     auto cell_x = static_cast<size_t>(x / step);
-    T newX = std::round(static_cast<T>(cell_x)) * step;
+    T newX = static_cast<T>(cell_x) * step;
     T delta = x - newX;
     if ((0 < delta) && (delta < step)) return cell_x;
     if ((delta < 0) && (delta > -step)) return cell_x;
@@ -120,28 +768,365 @@ private:
     return cell_x;
   }
 
-  Cell getCell(R_T r, THETA_T theta, bool &ok) const {
+  /*
+   * Voting kernel: adds weight to the cell of point in every column.
+   * All arithmetic runs in R_T on the column trigonometry tables, as cells are defined by
+   * R_T arithmetic (see getR); THETA_T is only used once per column when the tables are
+   * built, so mixed instantiations such as <float, long double> never reach wide or x87
+   * math here.
+   * Rows are computed by binColumns (vectorized in the library for float and double),
+   * binning is exactly the one of getRow and isOnLine.
+  */
+  void vote(const Point<R_T> &p, uint32_t weight = 1) {
+    binRows(p);
+    if (!sparse) {
+      bound += weight;
+      space.fit(bound);
+    }
+    addRows(weight);
+  }
+
+  /*
+   * Whether no cell of point is beyond the last row: the columns are only searched when the
+   * distance of the point, the largest r it votes for, reaches the last row
+  */
+  bool covers(const Point<R_T> &p) const {
+    size_t end = rOffset + rSize;
+    R_T distance = math_traits<R_T, THETA_T>::sqrt(p.x * p.x + p.y * p.y);
+    if (cellOf(distance, rStep) + 1 < end) return true;
+    for (size_t i = 0; i != thetaSize; ++i) {
+      R_T r = getR(p, i);
+      if (r >= 0 && cellOf(r, rStep) >= end) return false;
+    }
+    return true;
+  }
+
+  /*
+   * Removes weight from the cells of point in every column unless one of them holds less
+   * @return false if a counter would go below zero, nothing is removed then
+  */
+  bool unvote(const Point<R_T> &p, uint32_t weight) {
+    binRows(p);
+    if (sparse) {
+      for (size_t i = 0; i != thetaSize; ++i) {
+        uint32_t row = columnRows[i];
+        if (row != NO_ROW && hashed.get(keyOf(row, i)) < weight) return false;
+      }
+      for (size_t i = 0; i != thetaSize; ++i) {
+        uint32_t row = columnRows[i];
+        if (row != NO_ROW) hashed.at(keyOf(row, i)) -= weight;
+      }
+      return true;
+    }
+    switch (space.width) {
+      case 1: return takeVotes(space.data<uint8_t>(), weight);
+      case 2: return takeVotes(space.data<uint16_t>(), weight);
+      default: return takeVotes(space.data<uint32_t>(), weight);
+    }
+  }
+
+  // rows of the cells of point in every column into columnRows, see vote; NO_ROW for cells
+  // outside of the rSize rows with heads
+  void binRows(const Point<R_T> &p) {
+    binColumns(p.x, p.y, thetaCos.data(), thetaSin.data(), thetaSize, rStep,
+               static_cast<uint32_t>(rOffset), static_cast<uint32_t>(rSize), columnRows.data());
+  }
+
+  /*
+   * Adds weight to the cells of columnRows, dense counters must be wide enough for it
+  */
+  void addRows(uint32_t weight) {
+    if (sparse) {
+      size_t hits = 0;
+      for (size_t i = 0; i != thetaSize; ++i) {
+        uint32_t row = columnRows[i];
+        if (row != NO_ROW) columnKeys[hits++] = static_cast<uint64_t>(row) * columns + i;
+      }
+      hashed.addBatch(columnKeys.data(), hits, weight);
+      return;
+    }
+    switch (space.width) {
+      case 1: addVotes(space.data<uint8_t>(), weight); break;
+      case 2: addVotes(space.data<uint16_t>(), weight); break;
+      default: addVotes(space.data<uint32_t>(), weight);
+    }
+  }
+
+  /*
+   * Removes weight from the dense cells of columnRows: all of them are checked first, so
+   * the point is taken back whole or not at all
+  */
+  template <typename T>
+  bool takeVotes(T *counters, uint32_t weight) {
+    bool enough = true;
+    forEachVote([&](size_t j, size_t) {
+      if (counters[j] < weight) enough = false;
+    });
+    if (!enough) return false;
+    auto w = static_cast<T>(weight);
+    forEachVote([&](size_t j, size_t) { counters[j] -= w; });
+    return true;
+  }
+
+  /*
+   * Adds weight to the rows of columnRows. Pages of a lazy accumulator are marked as they
+   * are written
+  */
+  template <typename T>
+  void addVotes(T *counters, uint32_t weight) {
+    auto w = static_cast<T>(weight);
+    if (space.isLazy()) {
+      forEachVote([&](size_t j, size_t) {
+        space.touch(j);
+        counters[j] += w;
+      });
+      return;
+    }
+    forEachVote([&](size_t j, size_t) { counters[j] += w; });
+  }
+
+  /*
+   * Votes point as vote does and calls f(key, count) for each of its cells whose count then
+   * exceeds above; f returns the above of the next cells. Dense counters are compared as they
+   * are written, e.g. to follow the leading cells while voting (see
+   * HoughTransformer2d::transformTop)
+  */
+  template <typename F>
+  void voteFollowing(const Point<R_T> &p, uint32_t above, F f) {
+    if (sparse || space.isLazy()) {
+      vote(p);
+      for (size_t i = 0; i != thetaSize; ++i) {
+        uint32_t row = columnRows[i], c = row != NO_ROW ? count(row, i) : 0;
+        if (c > above) above = f(keyOf(row, i), c);
+      }
+      return;
+    }
+    binRows(p);
+    space.fit(++bound);
+    switch (space.width) {
+      case 1: addFollowing(space.data<uint8_t>(), above, f); break;
+      case 2: addFollowing(space.data<uint16_t>(), above, f); break;
+      default: addFollowing(space.data<uint32_t>(), above, f);
+    }
+  }
+
+  template <typename T, typename F>
+  void addFollowing(T *counters, uint32_t above, F f) {
+    forEachVote([&](size_t j, size_t i) {
+      uint32_t c = ++counters[j];
+      if (c > above) above = f(keyOf(columnRows[i], i), c);
+    });
+  }
+
+  /*
+   * Calls f(position, column) for the dense cell of every column of columnRows with a row,
+   * positions are rowOffset + columnOffset of the accumulator with the layout branch taken
+   * once per point
+  */
+  template <typename F>
+  void forEachVote(F f) const {
+    const size_t *columnOffset = space.columnOffset.data(), stride = space.rowStride;
+    if (space.layout == Layout::Tiled) {
+      const size_t tile = Accumulator::TILE;
+      for (size_t i = 0; i != thetaSize; ++i) {
+        uint32_t row = columnRows[i];
+        if (row != NO_ROW) f(row / tile * stride + row % tile * tile + columnOffset[i], i);
+      }
+      return;
+    }
+    for (size_t i = 0; i != thetaSize; ++i) {
+      uint32_t row = columnRows[i];
+      if (row != NO_ROW) f(row * stride + columnOffset[i], i);
+    }
+  }
+
+  template <typename D>
+  void addDense(const HoughSpace &rhs, size_t shift) {
+    switch (rhs.space.width) {
+      case 1: addDense<D, uint8_t>(rhs, shift); break;
+      case 2: addDense<D, uint16_t>(rhs, shift); break;
+      default: addDense<D, uint32_t>(rhs, shift);
+    }
+  }
+
+  /*
+   * Adds the rSize rows of the dense counters of rhs, whose row 0 is row shift of this space.
+   * In the same layout, with blocks that line up when tiled, they are one block of
+   * consecutive counters of this one, a column of it for the column-major layout, and the
+   * rows of the last block row cut by rSize for the tiled one
+  */
+  template <typename D, typename S>
+  void addDense(const HoughSpace &rhs, size_t shift) {
+    const size_t tile = Accumulator::TILE;
+    if (space.layout != rhs.space.layout || (space.layout == Layout::Tiled && shift % tile != 0)) {
+      addTransposed<D, S>(rhs, shift);
+      return;
+    }
+    D *dst = space.data<D>();
+    const S *src = rhs.space.template data<S>();
+    if (space.layout == Layout::ColumnMajor) {
+      for (size_t c = 0; c != columns; ++c) {
+        addCounters(dst + space.index(shift, c), src + rhs.space.index(0, c), rhs.rSize);
+      }
+      return;
+    }
+    size_t whole = space.layout == Layout::Tiled ? rhs.rSize / tile * tile : rhs.rSize;
+    addCounters(dst + space.rowOffset(shift), src, rhs.space.rowOffset(whole));
+    for (size_t r = whole; r != rhs.rSize; ++r) {
+      for (size_t c = 0; c < columns; c += tile) {
+        addCounters(dst + space.index(shift + r, c), src + rhs.space.index(r, c),
+                    std::min(tile, columns - c));
+      }
+    }
+  }
+
+  /*
+   * Adds the rSize rows of the dense counters of rhs in any layout, row 0 of rhs being row
+   * shift of this space. Squares of block x block cells are summed through the row and
+   * column offsets of both layouts, so the cache lines a square reads from one buffer and
+   * writes to the other stay in cache while it is transposed
+  */
+  template <typename D, typename S>
+  void addTransposed(const HoughSpace &rhs, size_t shift) {
+    const size_t block = 64;
+    D *dst = space.data<D>();
+    const S *src = rhs.space.template data<S>();
+    const size_t *dstColumn = space.columnOffset.data(), *srcColumn = rhs.space.columnOffset.data();
+    size_t dstRow[block], srcRow[block];
+    for (size_t r0 = 0; r0 < rhs.rSize; r0 += block) {
+      size_t n = std::min(block, rhs.rSize - r0);
+      for (size_t k = 0; k != n; ++k) {
+        dstRow[k] = space.rowOffset(shift + r0 + k);
+        srcRow[k] = rhs.space.rowOffset(r0 + k);
+      }
+      for (size_t c0 = 0; c0 < columns; c0 += block) {
+        size_t c1 = std::min(columns, c0 + block);
+        for (size_t k = 0; k != n; ++k) {
+          D *d = dst + dstRow[k];
+          const S *s = src + srcRow[k];
+          for (size_t c = c0; c != c1; ++c) {
+            d[dstColumn[c]] = static_cast<D>(d[dstColumn[c]] + s[srcColumn[c]]);
+          }
+        }
+      }
+    }
+  }
+
+  uint64_t keyOf(size_t row, size_t column) const {
+    return static_cast<uint64_t>(row) * columns + column;
+  }
+
+  uint32_t count(size_t row, size_t column) const {
+    return sparse ? hashed.get(keyOf(row, column)) : space.at(row, column);
+  }
+
+  void set(size_t row, size_t column, uint32_t value) {
+    if (sparse) {
+      hashed.at(keyOf(row, column)) = value;
+      return;
+    }
+    bound = std::max<uint64_t>(bound, value);
+    space.fit(bound);
+    space.set(row, column, value);
+  }
+
+  /*
+   * Calls f(row, column, count) in storage order: for every cell of a dense space and for
+   * every hit cell of a sparse one
+  */
+  template <typename F>
+  void forEachCount(F f) const {
+    if (sparse) {
+      hashed.forEach([&](uint64_t key, uint32_t c) { f(key / columns, key % columns, c); });
+      return;
+    }
+    space.forEach(f);
+  }
+
+  /*
+   * Row of the space for distance r, ok is false if r is outside of the rSize rows with
+   * heads; the two extra rows are never voted
+  */
+  size_t getRow(R_T r, bool &ok) const {
     size_t cell_r = getCellComponent(r, rStep, ok);
+    if (!ok) return 0;
+    ok = (cell_r >= rOffset) && (cell_r - rOffset < rSize);
+    return cell_r - rOffset;
+  }
+
+  /*
+   * Column of the space for angle theta, ok is false if theta is outside of the allocated ones
+  */
+  size_t getColumn(THETA_T theta, bool &ok) const {
+    size_t cell_theta = thetaSamples.empty() ? getCellComponent(theta, thetaStep, ok)
+                                             : getSample(theta, ok);
+    if (!ok) return 0;
+    if (!thetaColumn.empty()) {
+      cell_theta = cell_theta < thetaColumn.size() ? thetaColumn[cell_theta] : columns;
+    }
+    ok = cell_theta < columns;
+    return cell_theta;
+  }
+
+  /*
+   * Sample of the non-uniform grid closest to theta: the bucket gives the first candidate bin
+   * and buckets are narrower than any bin, so at most one more bound is checked
+  */
+  size_t getSample(THETA_T theta, bool &ok) const {
+    ok = true;
+    const THETA_T full = static_cast<THETA_T>(2) * math_traits<R_T, THETA_T>::pi();
+    theta = std::fmod(theta, full);
+    if (theta < 0) theta += full;
+    size_t last = thetaSamples.size() - 1;
+    if (thetaBound[last] > full && theta < thetaBound[last] - full) return last;
+    auto bucket = std::min(thetaBucket.size() - 1,
+                           static_cast<size_t>(theta / full * thetaBucket.size()));
+    size_t i = thetaBucket[bucket];
+    while (i <= last && theta >= thetaBound[i]) ++i;
+    return i > last ? 0 : i;
+  }
+
+  Cell getCell(R_T r, THETA_T theta, bool &ok) const {
+    size_t row = getRow(r, ok);
     if (!ok) return Cell();
-    size_t cell_theta = getCellComponent(theta, thetaStep, ok);
+    size_t column = getColumn(theta, ok);
     if (!ok) return Cell();
-    return Cell(cell_r, cell_theta);
+    return Cell(row, column);
   }
 
-  struct Node {
-    uint32_t count;
-    Line<R_T, THETA_T> line;
-    bool operator<(const Node &rhs) const { return count < rhs.count; }
-    Node(uint32_t count, Line<R_T, THETA_T> line) : count(count), line(line) {}
-  };
-
-  std::vector<std::vector<uint32_t>> space;
-  std::vector<THETA_T> thetaHead;
-  std::vector<R_T> rHead;
+  Accumulator space;
+  // rows and columns of the space, counting the two extra ones
+  size_t rows, columns;
+  bool sparse;
+  // no count exceeds it, dense counters are kept wide enough for it
+  uint64_t bound;
+  SparseAccumulator hashed;
+  ResourceVector<uint64_t> columnKeys;
+  ResourceVector<THETA_T> thetaHead;
+  ResourceVector<R_T> rHead;
+  // amount of filled heads, the space has two extra rows and columns
+  size_t rSize, thetaSize;
+  // r cell of the first row, and column of every theta cell when only some are allocated
+  size_t rOffset;
+  ResourceVector<size_t> thetaColumn;
+  // trigonometry of every column head and scratch rows of the voting kernel
+  ResourceVector<R_T> thetaCos, thetaSin;
+  ResourceVector<uint32_t> columnRows;
+  // non-uniform grid: samples (theta cells), upper bounds of their bins and the first
+  // sample of every bucket of the equal-width lookup table
+  ResourceVector<THETA_T> thetaSamples, thetaBound;
+  ResourceVector<size_t> thetaBucket;
 
-  HoughSpace(R_T rStep, THETA_T thetaStep, uint32_t rSize, uint32_t thetaSize) : rStep(rStep),
-    thetaStep(thetaStep), space(rSize + 2, std::vector<uint32_t>(thetaSize + 2, 0)),
-    thetaHead(thetaSize + 2), rHead(rSize + 2) {
+  HoughSpace(R_T rStep, THETA_T thetaStep, uint32_t rSize, uint32_t thetaSize,
+             const SpaceFormat &format = SpaceFormat()) : rStep(rStep), thetaStep(thetaStep),
+    space(accumulatorOf(rSize + 2, thetaSize + 2, format)),
+    rows(rSize + 2), columns(thetaSize + 2), sparse(format.sparse), bound(0),
+    hashed(format.backing.resource), columnKeys(tablesOf(format)),
+    thetaHead(thetaSize + 2, THETA_T(), tablesOf(format)),
+    rHead(rSize + 2, R_T(), tablesOf(format)), rSize(rSize), thetaSize(thetaSize), rOffset(0),
+    thetaColumn(tablesOf(format)), thetaCos(tablesOf(format)), thetaSin(tablesOf(format)),
+    columnRows(tablesOf(format)), thetaSamples(tablesOf(format)), thetaBound(tablesOf(format)),
+    thetaBucket(tablesOf(format)) {
     THETA_T thetaStep2 = thetaStep / static_cast<THETA_T>(2);
     R_T rStep2 = rStep / static_cast<R_T>(2);
     for (size_t i = 0; i < thetaSize; ++i) {
@@ -150,38 +1135,225 @@ private:
     for (size_t i = 0; i < rSize; ++i) {
       rHead[i] = i * rStep + rStep2;
     }
+    fillTrigonometry();
   }
 
-  friend HoughSpace<R_T, THETA_T> HoughTransformer2d<R_T, THETA_T>::transform(
-    const std::vector<Point<R_T>> &) const;
+  /*
+   * Space restricted to rSize rows starting from r cell rOffset and to the given theta cells
+  */
+  HoughSpace(R_T rStep, THETA_T thetaStep, size_t rOffset, size_t rSize,
+             const std::vector<size_t> &thetaCells, const SpaceFormat &format = SpaceFormat()) :
+    rStep(rStep), thetaStep(thetaStep),
+    space(accumulatorOf(rSize + 2, thetaCells.size() + 2, format)),
+    rows(rSize + 2), columns(thetaCells.size() + 2), sparse(format.sparse), bound(0),
+    hashed(format.backing.resource), columnKeys(tablesOf(format)),
+    thetaHead(thetaCells.size() + 2, THETA_T(), tablesOf(format)),
+    rHead(rSize + 2, R_T(), tablesOf(format)), rSize(rSize), thetaSize(thetaCells.size()),
+    rOffset(rOffset), thetaColumn(tablesOf(format)), thetaCos(tablesOf(format)),
+    thetaSin(tablesOf(format)), columnRows(tablesOf(format)), thetaSamples(tablesOf(format)),
+    thetaBound(tablesOf(format)), thetaBucket(tablesOf(format)) {
+    THETA_T thetaStep2 = thetaStep / static_cast<THETA_T>(2);
+    setColumns(thetaCells, [&](size_t cell) { return cell * thetaStep + thetaStep2; });
+  }
+
+  /*
+   * Space over a non-uniform grid of theta samples, only the given samples get columns
+  */
+  HoughSpace(R_T rStep, const std::vector<THETA_T> &samples, size_t rOffset, size_t rSize,
+             const std::vector<size_t> &thetaCells, const SpaceFormat &format = SpaceFormat()) :
+    rStep(rStep),
+    thetaStep(static_cast<THETA_T>(2) * math_traits<R_T, THETA_T>::pi() / samples.size()),
+    space(accumulatorOf(rSize + 2, thetaCells.size() + 2, format)),
+    rows(rSize + 2), columns(thetaCells.size() + 2), sparse(format.sparse), bound(0),
+    hashed(format.backing.resource), columnKeys(tablesOf(format)),
+    thetaHead(thetaCells.size() + 2, THETA_T(), tablesOf(format)),
+    rHead(rSize + 2, R_T(), tablesOf(format)), rSize(rSize), thetaSize(thetaCells.size()),
+    rOffset(rOffset), thetaColumn(tablesOf(format)), thetaCos(tablesOf(format)),
+    thetaSin(tablesOf(format)), columnRows(tablesOf(format)),
+    thetaSamples(samples.begin(), samples.end(), tablesOf(format)),
+    thetaBound(tablesOf(format)), thetaBucket(tablesOf(format)) {
+    const THETA_T full = static_cast<THETA_T>(2) * math_traits<R_T, THETA_T>::pi();
+    size_t m = samples.size();
+    thetaBound.resize(m);
+    THETA_T minGap = full;
+    for (size_t i = 0; i < m; ++i) {
+      THETA_T next = i + 1 < m ? samples[i + 1] : samples[0] + full;
+      thetaBound[i] = (samples[i] + next) / 2;
+      if (next > samples[i]) minGap = std::min(minGap, next - samples[i]);
+    }
+    size_t buckets = std::max<size_t>(m, static_cast<size_t>(2 * full / minGap) + 1);
+    thetaBucket.resize(std::min<size_t>(buckets, 1 << 20));
+    size_t i = 0;
+    for (size_t b = 0; b < thetaBucket.size(); ++b) {
+      THETA_T start = full * b / thetaBucket.size();
+      while (i < m && thetaBound[i] <= start) ++i;
+      thetaBucket[b] = i;
+    }
+    setColumns(thetaCells, [&](size_t cell) { return samples[cell]; });
+  }
+
+  /*
+   * Clears the space for rSize rows from r cell rOffset keeping its columns, the counters
+   * stay in their buffer or hash table when it is large enough
+  */
+  void reshape(size_t rOffset, size_t rSize, const SpaceFormat &format) {
+    bool moved = format.backing.resource != rHead.get_allocator().resource;
+    if (moved) moveTables(format);
+    rows = rSize + 2;
+    this->rSize = rSize;
+    this->rOffset = rOffset;
+    bound = 0;
+    rHead.assign(rows, 0);
+    R_T rStep2 = rStep / static_cast<R_T>(2);
+    for (size_t i = 0; i < rSize; ++i) {
+      rHead[i] = (rOffset + i) * rStep + rStep2;
+    }
+    if (format.sparse) {
+      space = accumulatorOf(rows, columns, format);
+      if (sparse && !moved) {
+        hashed.clear();
+      } else {
+        hashed = SparseAccumulator(format.backing.resource);
+      }
+      columnKeys.resize(thetaHead.size());
+    } else if (sparse || format.backing.lazy != space.isLazy() ||
+               format.backing.huge != space.hugePages() ||
+               format.backing.resource != space.memoryResource()) {
+      hashed = SparseAccumulator(format.backing.resource);
+      space = accumulatorOf(rows, columns, format);
+    } else {
+      space.reshape(rows, columns, format.layout, format.width);
+    }
+    sparse = format.sparse;
+  }
+
+  // allocator of the tables of a space of format, they come from its memory resource
+  static ResourceAllocator<char> tablesOf(const SpaceFormat &format) {
+    return ResourceAllocator<char>(format.backing.resource);
+  }
+
+  /*
+   * Copies the tables to the memory resource of format, e.g. when a space made with one
+   * resource is reshaped for another one
+  */
+  void moveTables(const SpaceFormat &format) {
+    moveTable(columnKeys, format);
+    moveTable(thetaHead, format);
+    moveTable(rHead, format);
+    moveTable(thetaColumn, format);
+    moveTable(thetaCos, format);
+    moveTable(thetaSin, format);
+    moveTable(columnRows, format);
+    moveTable(thetaSamples, format);
+    moveTable(thetaBound, format);
+    moveTable(thetaBucket, format);
+  }
+
+  template <typename T>
+  static void moveTable(ResourceVector<T> &table, const SpaceFormat &format) {
+    table = ResourceVector<T>(table.begin(), table.end(), tablesOf(format));
+  }
+
+  /*
+   * Counters of a dense space. A sparse space keeps an empty accumulator, which still holds
+   * the memory resource of its temporaries
+  */
+  static Accumulator accumulatorOf(size_t rows, size_t columns, const SpaceFormat &format) {
+    if (format.sparse) rows = columns = 0;
+    return Accumulator(rows, columns, format.layout, format.width, format.backing);
+  }
+
+  template <typename F>
+  void setColumns(const std::vector<size_t> &thetaCells, F headOf) {
+    R_T rStep2 = rStep / static_cast<R_T>(2);
+    size_t cells = thetaCells.empty() ? 0 : thetaCells.back() + 1;
+    thetaColumn.assign(cells, columns);
+    for (size_t i = 0; i < thetaCells.size(); ++i) {
+      thetaHead[i] = headOf(thetaCells[i]);
+      thetaColumn[thetaCells[i]] = i;
+    }
+    for (size_t i = 0; i < rSize; ++i) {
+      rHead[i] = (rOffset + i) * rStep + rStep2;
+    }
+    fillTrigonometry();
+  }
+
+  void fillTrigonometry() {
+    thetaCos.resize(thetaHead.size());
+    thetaSin.resize(thetaHead.size());
+    columnRows.resize(thetaHead.size());
+    if (sparse) columnKeys.resize(thetaHead.size());
+    for (size_t i = 0; i < thetaHead.size(); ++i) {
+      thetaCos[i] = math_traits<R_T, THETA_T>::cos(thetaHead[i]);
+      thetaSin[i] = math_traits<R_T, THETA_T>::sin(thetaHead[i]);
+    }
+  }
+
+  friend struct HoughTransformer2d<R_T, THETA_T>;
+  friend struct FastHoughTransformer<R_T, THETA_T>;
+  friend struct RadonTransformer<R_T, THETA_T>;
+  friend struct OutOfCoreHoughSpace<R_T, THETA_T>;
+  friend struct SpaceFile<R_T, THETA_T>;
 
   void update(R_T r, THETA_T theta) {
     bool ok = true;
-    size_t cell_theta = getCellComponent(theta, thetaStep, ok);
+    size_t cell_theta = getColumn(theta, ok);
     if (!ok) return;
     update(r, cell_theta);
   }
 
   void checkDist(size_t rt, size_t thetat) {
-    if (rt >= space.size())
-      std::cerr << rt << " >= " << space.size() << std::endl;
-    if (thetat >= space[0].size())
-      std::cerr << thetat << " >= " << space[0].size() << std::endl;
+    if (rt >= rows)
+      std::cerr << rt << " >= " << rows << std::endl;
+    if (thetat >= columns)
+      std::cerr << thetat << " >= " << columns << std::endl;
   }
 
-  void update(size_t rt, size_t thetat) {
+  void update(size_t rt, size_t thetat, uint32_t weight = 1) {
     #ifndef NDEBUG
     checkDist(rt, thetat);
     #endif
-    ++space[rt][thetat];
+    set(rt, thetat, count(rt, thetat) + weight);
   }
 
-  void update(R_T r, size_t thetat) {
+  void updateMax(R_T r, THETA_T theta, uint32_t value) {
     bool ok = true;
-    size_t cell_r = getCellComponent(r, rStep, ok);
+    Cell cell = getCell(r, theta, ok);
     if (!ok) return;
-    update(cell_r, thetat);
+    if (value > count(cell.rTimes, cell.thetaTimes)) set(cell.rTimes, cell.thetaTimes, value);
+  }
+
+  void update(R_T r, size_t thetat, uint32_t weight = 1) {
+    bool ok = true;
+    size_t row = getRow(r, ok);
+    if (!ok) return;
+    update(row, thetat, weight);
   }
 };
 
+/*
+ * Result of a transform that may stop before voting all points
+ * @field voted - amount of voted points
+ * @field complete - all points were voted
+ * @field processed - fraction of points voted, in [0, 1]
+*/
+template <typename R_T, typename THETA_T>
+struct PartialHoughSpace {
+  HoughSpace<R_T, THETA_T> space;
+  size_t voted;
+  bool complete;
+  double processed;
+  PartialHoughSpace(HoughSpace<R_T, THETA_T> &&space, size_t voted, size_t total) :
+    space(std::move(space)), voted(voted), complete(voted == total),
+    processed(total == 0 ? 1 : static_cast<double>(voted) / total) {}
+};
+
+// instantiated in the transform library
+extern template struct HoughTransformer2d<float, float>;
+extern template struct HoughTransformer2d<double, double>;
+extern template struct HoughSpace<float, float>;
+extern template struct HoughSpace<double, double>;
+extern template struct PartialHoughSpace<float, float>;
+extern template struct PartialHoughSpace<double, double>;
+
 #endif // HOUGH_TRANSFORM_H
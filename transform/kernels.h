@@ -0,0 +1,59 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+
+/*
+ * Marks columns whose cell is outside of the allocated rows
+*/
+const uint32_t NO_ROW = 0xffffffffu;
+
+/*
+ * Row of the cell hit by point (x, y) in each of n columns, NO_ROW if the distance is
+ * negative or outside of rows [offset, offset + rows) in r cells.
+ * Binning is the one of HoughSpace::getRow: cell = trunc(r / step), corrected by one when
+ * the remainder is off by more than a step. The loop is branch-free so it vectorizes.
+*/
+template <typename T>
+inline void binColumns(T x, T y, const T *cs, const T *sn, size_t n, T step, uint32_t offset,
+                       uint32_t rows, uint32_t *out) {
+  const T limit = static_cast<T>(1u << 30);
+  for (size_t i = 0; i != n; ++i) {
+    T r = x * cs[i] + y * sn[i];
+    T q = r / step;
+    uint32_t inside = static_cast<uint32_t>(r >= 0) & static_cast<uint32_t>(q < limit);
+    auto cell = static_cast<int32_t>(std::max(std::min(q, limit), static_cast<T>(0)));
+    T delta = r - static_cast<T>(cell) * step;
+    cell += static_cast<int32_t>(delta > step) - static_cast<int32_t>(delta < -step);
+    uint32_t row = static_cast<uint32_t>(cell) - offset;
+    uint32_t valid = inside & static_cast<uint32_t>(row < rows);
+    out[i] = row | (valid - 1);
+  }
+}
+
+/*
+ * Adds n counters of src to dst, every sum fits in D. The loop vectorizes, counters of
+ * different widths are widened or narrowed on the way
+*/
+template <typename D, typename S>
+inline void addCounters(D *dst, const S *src, size_t n) {
+  for (size_t i = 0; i != n; ++i) dst[i] = static_cast<D>(dst[i] + src[i]);
+}
+
+/*
+ * Versions for float and double are compiled into the transform library for several
+ * instruction sets and picked at load time
+*/
+void binColumns(float x, float y, const float *cs, const float *sn, size_t n, float step,
+                uint32_t offset, uint32_t rows, uint32_t *out);
+void binColumns(double x, double y, const double *cs, const double *sn, size_t n, double step,
+                uint32_t offset, uint32_t rows, uint32_t *out);
+
+// versions for counters of one width, compiled as binColumns
+void addCounters(uint8_t *dst, const uint8_t *src, size_t n);
+void addCounters(uint16_t *dst, const uint16_t *src, size_t n);
+void addCounters(uint32_t *dst, const uint32_t *src, size_t n);
+
+#endif // KERNELS_H
@@ -0,0 +1,160 @@
+#ifndef MEMORY_RESOURCE_H
+#define MEMORY_RESOURCE_H
+
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+#include <type_traits>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Source of memory for spaces and their temporaries, the C++11 counterpart of
+ * std::pmr::memory_resource. Implementations need not be thread safe, a resource is meant
+ * to be used by one thread, e.g. one arena per worker.
+*/
+struct MemoryResource {
+  virtual ~MemoryResource() {}
+  // alignment is a power of two, throws std::bad_alloc when out of memory
+  virtual void *allocate(size_t bytes, size_t alignment) = 0;
+  virtual void deallocate(void *p, size_t bytes, size_t alignment) = 0;
+};
+
+/*
+ * Aligned blocks from the C heap
+*/
+struct HeapResource : MemoryResource {
+  void *allocate(size_t bytes, size_t alignment) override {
+    void *p = nullptr;
+    alignment = std::max(alignment, sizeof(void *));
+    if (posix_memalign(&p, alignment, std::max<size_t>(bytes, 1)) != 0) throw std::bad_alloc();
+    return p;
+  }
+
+  void deallocate(void *p, size_t, size_t) override { std::free(p); }
+};
+
+inline MemoryResource *heapResource() {
+  static HeapResource heap;
+  return &heap;
+}
+
+/*
+ * Monotonic arena for per-frame memory: allocation bumps a pointer in the current chunk,
+ * deallocation does nothing and release frees everything at once. Chunks come from
+ * upstream; when a frame needed several of them, release replaces them by one chunk of
+ * their total size, so later frames of the same size allocate from one chunk and release
+ * is O(1). Whatever was allocated from the arena must not be used after release.
+*/
+struct MonotonicArena : MemoryResource {
+  explicit MonotonicArena(size_t chunkBytes = 1 << 20,
+                          MemoryResource *upstream = heapResource()) :
+    upstream(upstream), chunkBytes(std::max<size_t>(chunkBytes, 256)), last(nullptr),
+    position(nullptr), end(nullptr) {}
+
+  MonotonicArena(const MonotonicArena &) = delete;
+  MonotonicArena &operator=(const MonotonicArena &) = delete;
+
+  ~MonotonicArena() { freeChunks(); }
+
+  void *allocate(size_t bytes, size_t alignment) override {
+    unsigned char *p = align(position, alignment);
+    if (last == nullptr || p > end || static_cast<size_t>(end - p) < bytes) {
+      addChunk(std::max(chunkBytes, bytes + alignment + sizeof(Chunk)));
+      p = align(position, alignment);
+    }
+    position = p + bytes;
+    return p;
+  }
+
+  void deallocate(void *, size_t, size_t) override {}
+
+  void release() {
+    if (last != nullptr && last->previous != nullptr) {
+      size_t total = 0;
+      for (Chunk *c = last; c != nullptr; c = c->previous) total += c->bytes;
+      freeChunks();
+      addChunk(total);
+    }
+    if (last != nullptr) position = reinterpret_cast<unsigned char *>(last + 1);
+  }
+
+  // bytes of all chunks taken from upstream
+  size_t capacity() const {
+    size_t total = 0;
+    for (Chunk *c = last; c != nullptr; c = c->previous) total += c->bytes;
+    return total;
+  }
+
+private:
+  // header at the start of every chunk, chunks are linked from the newest one
+  struct Chunk {
+    Chunk *previous;
+    size_t bytes;
+  };
+
+  static unsigned char *align(unsigned char *p, size_t alignment) {
+    uintptr_t v = reinterpret_cast<uintptr_t>(p);
+    return p + ((alignment - v % alignment) % alignment);
+  }
+
+  void addChunk(size_t bytes) {
+    Chunk *c = static_cast<Chunk *>(upstream->allocate(bytes, alignof(std::max_align_t)));
+    c->previous = last;
+    c->bytes = bytes;
+    last = c;
+    position = reinterpret_cast<unsigned char *>(c + 1);
+    end = reinterpret_cast<unsigned char *>(c) + bytes;
+  }
+
+  void freeChunks() {
+    while (last != nullptr) {
+      Chunk *previous = last->previous;
+      upstream->deallocate(last, last->bytes, alignof(std::max_align_t));
+      last = previous;
+    }
+    position = end = nullptr;
+  }
+
+  MemoryResource *upstream;
+  size_t chunkBytes;
+  Chunk *last;
+  unsigned char *position, *end;
+};
+
+/*
+ * Standard allocator drawing from a memory resource, for containers of temporaries. The
+ * resource follows the contents on assignment and swap, as for the counters of Accumulator
+*/
+template <typename T>
+struct ResourceAllocator {
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  ResourceAllocator(MemoryResource *resource = heapResource()) : resource(resource) {}
+
+  template <typename U>
+  ResourceAllocator(const ResourceAllocator<U> &rhs) : resource(rhs.resource) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(resource->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *p, size_t n) { resource->deallocate(p, n * sizeof(T), alignof(T)); }
+
+  template <typename U>
+  bool operator==(const ResourceAllocator<U> &rhs) const { return resource == rhs.resource; }
+  template <typename U>
+  bool operator!=(const ResourceAllocator<U> &rhs) const { return resource != rhs.resource; }
+
+  MemoryResource *resource;
+};
+
+template <typename T>
+using ResourceVector = std::vector<T, ResourceAllocator<T>>;
+
+#endif // MEMORY_RESOURCE_H
@@ -0,0 +1,220 @@
+#ifndef OUT_OF_CORE_SPACE_H
+#define OUT_OF_CORE_SPACE_H
+
+#include "utils.h"
+#include "hough_transform.h"
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <algorithm>
+#ifdef ACCUMULATOR_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Hough space kept in a file, for grids larger than memory. The regular grid of
+ * HoughTransformer2d(rStep, thetaStep) is split into slabs of consecutive theta columns whose
+ * counters fit in memoryBudget bytes. Every slab is a partial HoughSpace mapped from its own
+ * range of the file and voted with all points in turn, so points are streamed once per slab
+ * and only one slab is resident at a time. getLines merges the best cells of the slabs in the
+ * order of HoughSpace::getLines, so get and getLines give what the in-memory transform would.
+ * The last slab used stays mapped, so get and isOnLine of cells of one slab map nothing; a
+ * slab replacing it remaps the counters only, its theta heads and trigonometry are copied
+ * from tables of the whole grid computed once per transform.
+ * The file is left in place, the caller removes it.
+*/
+template <typename R_T, typename THETA_T>
+struct OutOfCoreHoughSpace {
+private:
+  using uint32_t = uint;
+  using traits = math_traits<R_T, THETA_T>;
+  using space_t = HoughSpace<R_T, THETA_T>;
+public:
+  const R_T rStep;
+  const THETA_T thetaStep;
+
+  /*
+   * @param memoryBudget - bytes of counters of a slab, at least one column is voted at a time
+  */
+  OutOfCoreHoughSpace(R_T rStep, THETA_T thetaStep, size_t memoryBudget) : rStep(rStep),
+    thetaStep(thetaStep),
+    thetaSize(static_cast<size_t>(static_cast<THETA_T>(2) * traits::pi() / thetaStep) + 2),
+    memoryBudget(memoryBudget), file(-1), rSize(0), width(4), slabColumns(0), slabBytes(0),
+    residentSlab(0) {}
+
+  OutOfCoreHoughSpace(const OutOfCoreHoughSpace &) = delete;
+  OutOfCoreHoughSpace &operator=(const OutOfCoreHoughSpace &) = delete;
+
+  ~OutOfCoreHoughSpace() { closeFile(); }
+
+  /*
+   * Votes points into the file at path, which is created or truncated
+   * @return false if the file can not be created or its space reserved, the space is empty then
+  */
+  bool transform(const std::vector<Point<R_T>> &points, const std::string &path) {
+    closeFile();
+    R_T maxR = 0;
+    for (const auto &p : points) maxR = std::max(p.x * p.x + p.y * p.y, maxR);
+    rSize = static_cast<size_t>(traits::sqrt(maxR) / rStep) + 10;
+    width = Accumulator::widthFor(std::max<size_t>(points.size(), 1));
+    size_t columnBytes = (rSize + 2) * width;
+    size_t fit = memoryBudget / columnBytes;
+    slabColumns = std::min(thetaSize, fit > 2 ? fit - 2 : 1);
+    slabBytes = columnBytes * (slabColumns + 2);
+    if (!openFile(path, slabs() * slabBytes)) {
+      closeFile();
+      return false;
+    }
+    fillTrigonometry();
+    for (size_t s = 0; s != slabs(); ++s) {
+      space_t &space = slab(s);
+      for (const auto &p : points) space.vote(p);
+    }
+    return true;
+  }
+
+  uint32_t get(R_T r, THETA_T theta) const {
+    size_t s = slabOf(theta);
+    return s < slabs() ? slab(s).get(r, theta) : 0;
+  }
+
+  /*
+   * Up to amount cells with more than one vote in the order of HoughSpace::getLines. Every
+   * slab is scanned once into one heap of the best amount cells, so per slab top lists are
+   * merged without keeping more than amount cells
+  */
+  std::vector<Line<R_T, THETA_T>> getLines(uint32_t amount) const {
+    // (count, row * columns + column) of the whole grid, the smallest on top
+    using node_t = std::pair<uint32_t, uint64_t>;
+    std::priority_queue<node_t, std::vector<node_t>, std::greater<node_t>> top;
+    const uint64_t columns = thetaSize + 2;
+    for (size_t s = 0; s != slabs() && amount != 0; ++s) {
+      const uint64_t first = s * slabColumns;
+      slab(s).forEachCount([&](size_t rt, size_t thetat, uint32_t c) {
+        if (c <= 1) return;
+        node_t node(c, rt * columns + first + thetat);
+        if (top.size() < amount) {
+          top.push(node);
+        } else if (top.top() < node) {
+          top.pop();
+          top.push(node);
+        }
+      });
+    }
+    std::vector<node_t> nodes;
+    for (; !top.empty(); top.pop()) nodes.push_back(top.top());
+    const R_T rStep2 = rStep / static_cast<R_T>(2);
+    const THETA_T thetaStep2 = thetaStep / static_cast<THETA_T>(2);
+    std::vector<Line<R_T, THETA_T>> lines;
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+      lines.emplace_back(it->second / columns * rStep + rStep2,
+                         it->second % columns * thetaStep + thetaStep2);
+    }
+    return lines;
+  }
+
+  bool isOnLine(const Line<R_T, THETA_T> &line, const Point<R_T> &p) const {
+    size_t s = slabOf(line.theta);
+    assert(s < slabs());
+    return slab(s).isOnLine(line, p);
+  }
+
+  // amount of slabs the grid is voted in, zero before transform
+  size_t slabs() const {
+    return slabColumns == 0 ? 0 : (thetaSize + slabColumns - 1) / slabColumns;
+  }
+
+private:
+  /*
+   * Slab s mapped from the file: columns [s * slabColumns, (s + 1) * slabColumns) of the grid
+   * plus the two extra ones of a space, at slabBytes * s. It stays resident until another
+   * slab is asked for, which takes over its space when both have as many columns: the
+   * counters are remapped and the column tables copied from those of the grid
+  */
+  space_t &slab(size_t s) const {
+    if (resident && residentSlab == s) return *resident;
+    size_t first = s * slabColumns, n = std::min(thetaSize, first + slabColumns) - first;
+    SpaceFormat format;
+    format.width = width;
+    format.backing.file = file;
+    format.backing.offset = static_cast<uint64_t>(s) * slabBytes;
+    residentSlab = s;
+    if (!resident || resident->thetaSize != n) {
+      std::vector<size_t> cells(n);
+      for (size_t i = 0; i != n; ++i) cells[i] = first + i;
+      resident.reset(new space_t(rStep, thetaStep, 0, rSize, cells, format));
+      return *resident;
+    }
+    space_t &space = *resident;
+    space.space = space_t::accumulatorOf(rSize + 2, n + 2, format);
+    space.bound = 0;
+    space.thetaColumn.assign(first + n, n + 2);
+    for (size_t i = 0; i != n; ++i) {
+      space.thetaColumn[first + i] = i;
+      space.thetaHead[i] = heads[first + i];
+      space.thetaCos[i] = cosines[first + i];
+      space.thetaSin[i] = sines[first + i];
+    }
+    return space;
+  }
+
+  // heads of the theta cells of the grid and their trigonometry, as a space computes them
+  void fillTrigonometry() {
+    const THETA_T thetaStep2 = thetaStep / static_cast<THETA_T>(2);
+    heads.resize(thetaSize);
+    cosines.resize(thetaSize);
+    sines.resize(thetaSize);
+    for (size_t c = 0; c != thetaSize; ++c) {
+      heads[c] = c * thetaStep + thetaStep2;
+      cosines[c] = traits::cos(heads[c]);
+      sines[c] = traits::sin(heads[c]);
+    }
+  }
+
+  // slab of the column of theta, slabs() when there is none
+  size_t slabOf(THETA_T theta) const {
+    if (slabColumns == 0 || !(theta >= 0)) return slabs();
+    size_t column = space_t::cellOf(theta, thetaStep);
+    return column < thetaSize ? column / slabColumns : slabs();
+  }
+
+  bool openFile(const std::string &path, uint64_t bytes) {
+#ifdef ACCUMULATOR_MMAP
+    file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) return false;
+    // blocks are reserved up front, a full disk would otherwise fault on a vote
+    return ftruncate(file, static_cast<off_t>(bytes)) == 0 &&
+           posix_fallocate(file, 0, static_cast<off_t>(bytes)) == 0;
+#else
+    (void) path;
+    (void) bytes;
+    return false;
+#endif
+  }
+
+  void closeFile() {
+    resident.reset();
+#ifdef ACCUMULATOR_MMAP
+    if (file >= 0) close(file);
+#endif
+    file = -1;
+    slabColumns = 0;
+  }
+
+  const size_t thetaSize, memoryBudget;
+  int file;
+  // rows of the grid without the two extra ones, and bytes per counter
+  size_t rSize;
+  unsigned width;
+  // theta columns of a full slab and bytes of a slab in the file
+  size_t slabColumns, slabBytes;
+  std::vector<THETA_T> heads;
+  std::vector<R_T> cosines, sines;
+  // the mapped slab, see slab
+  mutable std::unique_ptr<space_t> resident;
+  mutable size_t residentSlab;
+};
+
+#endif // OUT_OF_CORE_SPACE_H
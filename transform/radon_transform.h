@@ -0,0 +1,126 @@
+#ifndef RADON_TRANSFORM_H
+#define RADON_TRANSFORM_H
+
+#include "utils.h"
+#include "hough_transform.h"
+#include "fft.h"
+#include <vector>
+#include <complex>
+#include <algorithm>
+
+/*
+ * Radon transform of a grayscale image through the Fourier slice theorem.
+ * The image is zero padded to n x n (n >= twice its size, so projections do not wrap and the
+ * spectrum is oversampled), centered and transformed by 2D FFT once. For every theta of the
+ * HoughSpace grid the spectrum is sampled along the radial line of that direction with
+ * bilinear interpolation, and the inverse 1D FFT of the slice gives the projection.
+ * A cell receives the line integral over its r strip (projection * rStep), rounded to a counter,
+ * so it approximates weighted voting of the pixels with their intensities.
+ * Cost is O(n^2 log n + thetaSize * n log n) independent of the amount of non-zero pixels.
+*/
+template <typename R_T, typename THETA_T>
+struct RadonTransformer {
+private:
+  using uint32_t = uint;
+  using traits = math_traits<R_T, THETA_T>;
+  using complex = std::complex<double>;
+public:
+  RadonTransformer(R_T rStep, THETA_T thetaStep) : rStep(rStep), thetaStep(thetaStep) {}
+
+  template <typename PIXEL_T>
+  HoughSpace<R_T, THETA_T> transform(const Image<PIXEL_T> &image) const {
+    auto sizeTheta = static_cast<size_t>(static_cast<THETA_T>(2) * traits::pi() / thetaStep) + 2;
+    size_t w = image.width, h = image.height;
+    R_T diag = traits::sqrt(static_cast<R_T>(w * w + h * h));
+    size_t sizeR = static_cast<size_t>(diag / rStep) + 10;
+    // a line integral does not exceed the total intensity, up to interpolation error
+    // that the space absorbs by widening its counters
+    double total = 0;
+    for (const auto &v : image.pixels) total += static_cast<double>(v);
+    SpaceFormat format;
+    format.width = Accumulator::widthFor(static_cast<uint64_t>(total * rStep));
+    HoughSpace<R_T, THETA_T> space(rStep, thetaStep, sizeR, sizeTheta, format);
+    if (w == 0 || h == 0) return space;
+
+    size_t n = 1;
+    while (n < 2 * std::max(w, h)) n <<= 1;
+    size_t cx = w / 2, cy = h / 2;
+    std::vector<complex> spectrum(n * n);
+    for (size_t y = 0; y < h; ++y) {
+      size_t iy = (y + n - cy) % n;
+      double ky = deapodization(static_cast<double>(y) - cy, n);
+      for (size_t x = 0; x < w; ++x) {
+        double k = ky * deapodization(static_cast<double>(x) - cx, n);
+        spectrum[iy * n + (x + n - cx) % n] = static_cast<double>(image.at(x, y)) * k;
+      }
+    }
+    fft2d(spectrum, n, false);
+
+    std::vector<complex> slice(n);
+    for (size_t i = 0; i != sizeTheta; ++i) {
+      double theta = static_cast<double>(space.thetaHead[i]);
+      double c = std::cos(theta), s = std::sin(theta);
+      for (size_t k = 0; k < n; ++k) {
+        double freq = k < n / 2 ? static_cast<double>(k) : static_cast<double>(k) - n;
+        slice[k] = sample(spectrum, n, freq * c, freq * s);
+      }
+      fft(slice, true);
+      double shift = static_cast<double>(cx) * c + static_cast<double>(cy) * s;
+      for (size_t j = 0; j < space.rSize; ++j) {
+        double t = static_cast<double>(space.rHead[j]) - shift;
+        double value = projection(slice, n, t) * static_cast<double>(rStep);
+        if (value >= 0.5) space.set(j, i, static_cast<uint32_t>(std::lround(value)));
+      }
+    }
+    return space;
+  }
+
+private:
+
+  /*
+   * Bilinear interpolation in frequency multiplies the image by sinc^2(pi * x / n) along
+   * each axis, the image is divided by it beforehand to keep integrals unbiased
+  */
+  static double deapodization(double x, size_t n) {
+    if (x == 0) return 1;
+    double a = 3.14159265358979323846 * x / static_cast<double>(n);
+    double sinc = std::sin(a) / a;
+    return 1 / (sinc * sinc);
+  }
+
+  /*
+   * Bilinear interpolation of the periodic spectrum at fractional frequency (fx, fy)
+  */
+  static complex sample(const std::vector<complex> &spectrum, size_t n, double fx, double fy) {
+    double flx = std::floor(fx), fly = std::floor(fy);
+    double ax = fx - flx, ay = fy - fly;
+    auto wrap = [n](double v) {
+      long long m = static_cast<long long>(v) % static_cast<long long>(n);
+      return static_cast<size_t>(m < 0 ? m + static_cast<long long>(n) : m);
+    };
+    size_t x0 = wrap(flx), y0 = wrap(fly);
+    size_t x1 = (x0 + 1) % n, y1 = (y0 + 1) % n;
+    return (1 - ay) * ((1 - ax) * spectrum[y0 * n + x0] + ax * spectrum[y0 * n + x1]) +
+           ay * ((1 - ax) * spectrum[y1 * n + x0] + ax * spectrum[y1 * n + x1]);
+  }
+
+  /*
+   * Linear interpolation of the projection at offset t from the image center,
+   * zero outside of the unwrapped range
+  */
+  static double projection(const std::vector<complex> &slice, size_t n, double t) {
+    double half = static_cast<double>(n / 2);
+    if (t < -half || t >= half - 1) return 0;
+    double ft = std::floor(t);
+    double a = t - ft;
+    auto index = [n](double v) {
+      return static_cast<size_t>(v < 0 ? v + static_cast<double>(n) : v);
+    };
+    return (1 - a) * slice[index(ft)].real() + a * slice[index(ft + 1)].real();
+  }
+
+  const R_T rStep;
+  const THETA_T thetaStep;
+};
+
+#endif // RADON_TRANSFORM_H
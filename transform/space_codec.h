@@ -0,0 +1,266 @@
+#ifndef SPACE_CODEC_H
+#define SPACE_CODEC_H
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Compression of dense counters for storage and transfer. Counters are cut in lines of
+ * consecutive ones, e.g. the rows of a row-major buffer. A line is a LEB128 varint token per
+ * non-zero counter: 2 * gap + 0 when it equals the previous non-zero counter of the line, or
+ * 2 * gap + 1 and then z - 1 for a difference of zigzag code z, where gap is the run of zeros
+ * before it. A line that ends with zeros ends with the token 2 * gap of the run up to its end.
+ * Zero runs cost nothing beyond their gap, and votes of a few points, mostly ones next to
+ * ones, take a byte per non-zero counter. Both directions pass the counters once: encoding
+ * tests 64 counters at a time (SSE2 compares where available) and codes the set bits of
+ * their non-zero mask, decoding zeroes a line while it is in cache and writes only the
+ * non-zero counters into it; when a word of code has no continuation bits (SWAR test), its
+ * eight single byte varints are taken without bound or continuation checks.
+ * Cost is a pass over the counters plus some nanoseconds per non-zero counter, so the codec
+ * trades time for size: decoding stays below a copy of the counters up to a few percent of
+ * non-zero counters, encoding about matches a copy only below one percent; dense counters
+ * take several copies both ways.
+*/
+struct SpaceCodec {
+  /*
+   * Appends the code of n counters in lines of line counters to out
+   * @param maxBytes - code size to give up at
+   * @return false if the code of the counters would take more than maxBytes, out is
+   *  partly written then
+  */
+  template <typename T>
+  static bool encode(const T *counters, size_t n, size_t line, std::vector<uint8_t> &out,
+                     size_t maxBytes = std::numeric_limits<size_t>::max()) {
+    const size_t start = out.size();
+    // code is written through a pointer into room of out, made before a block of counters
+    // with a non-zero one; it grows by a few blocks of room at a time, so that a call
+    // zeroes about as much room as it writes code, e.g. when lines are coded one per call
+    uint8_t *o = out.data() + start, *end = o;
+    for (size_t begin = 0; begin < n; begin += line) {
+      const T *c = counters + begin;
+      size_t length = std::min(n - begin, line);
+      T last = 0;
+      // the first counter of the line not coded yet
+      size_t next = 0, i = 0;
+      for (; length - i >= BLOCK; i += BLOCK) {
+        uint64_t mask = nonZeroMask(c + i);
+        if (mask == 0) continue;
+        if (static_cast<size_t>(end - o) < BLOCK_ROOM) o = grow(out, o, end);
+        o = putCounters(c, i, mask, next, last, o);
+      }
+      uint64_t mask = 0;
+      for (size_t k = i; k != length; ++k) mask |= static_cast<uint64_t>(c[k] != 0) << (k - i);
+      if (static_cast<size_t>(end - o) < BLOCK_ROOM) o = grow(out, o, end);
+      o = putCounters(c, i, mask, next, last, o);
+      if (next != length) o = putVarint(2 * static_cast<uint64_t>(length - next), o);
+      if (static_cast<size_t>(o - out.data()) - start > maxBytes) {
+        out.resize(static_cast<size_t>(o - out.data()));
+        return false;
+      }
+    }
+    out.resize(static_cast<size_t>(o - out.data()));
+    return true;
+  }
+
+  /*
+   * Decodes n counters in lines of line counters from bytes of code
+   * @return false if the code is malformed, does not fill the counters exactly or leaves
+   *  the range of T; counters are partly written then
+  */
+  template <typename T>
+  static bool decode(const uint8_t *code, size_t bytes, T *counters, size_t n, size_t line) {
+    const uint8_t *in = code, *inEnd = code + bytes;
+    for (size_t begin = 0; begin < n; begin += line) {
+      T *c = counters + begin, *end = counters + std::min(n, begin + line);
+      std::memset(c, 0, static_cast<size_t>(end - c) * sizeof(T));
+      T last = 0;
+      while (c != end) {
+        uint64_t word;
+        if (inEnd - in >= 8 && (std::memcpy(&word, in, 8), (word & HIGH_BITS) == 0)) {
+          // eight single byte varints, a difference that starts in them may end in them
+          const uint8_t *stop = in + 7;
+          while (in < stop && c != end) {
+            uint8_t token = *in++;
+            if (!put(token >> 1, (token & 1) ? *in++ + 1u : 0u, last, c, end)) return false;
+          }
+          continue;
+        }
+        uint64_t token, zigzag = 0;
+        if (!getVarint(in, inEnd, token) || ((token & 1) && !getVarint(in, inEnd, zigzag)) ||
+            !put(token >> 1, (token & 1) ? zigzag + 1 : 0, last, c, end)) return false;
+      }
+    }
+    return in == inEnd;
+  }
+
+private:
+  static const uint64_t HIGH_BITS = 0x8080808080808080ull;
+  // bytes of a 64 bit varint
+  static const size_t MAX_VARINT_BYTES = 10;
+  // counters tested for zeros at once by encode, a bit of a mask each
+  static const size_t BLOCK = 64;
+  // code of a block at most, two varints per counter and the gap that ends a line
+  static const size_t BLOCK_ROOM = (BLOCK + 1) * 2 * MAX_VARINT_BYTES;
+
+  /*
+   * Makes room for a few blocks of code after o in out, which ends at end, and moves both
+   * pointers to the new buffer; out grows geometrically when it reallocates
+  */
+  static uint8_t *grow(std::vector<uint8_t> &out, uint8_t *o, uint8_t *&end) {
+    auto at = static_cast<size_t>(o - out.data());
+    out.resize(at + 4 * BLOCK_ROOM);
+    end = out.data() + out.size();
+    return out.data() + at;
+  }
+
+  /*
+   * Bit k set for every non-zero counter c[k] of BLOCK counters. SSE2 compares 16 bytes at
+   * a time and packs the results into bits; elsewhere the flags are gathered by a multiply,
+   * eight at a time
+  */
+#if defined(__SSE2__)
+  static uint64_t nonZeroMask(const uint8_t *c) {
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t zeros = 0;
+    for (size_t q = 0; q != 4; ++q) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(c + 16 * q));
+      zeros |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero))) << (16 * q);
+    }
+    return ~zeros;
+  }
+
+  static uint64_t nonZeroMask(const uint16_t *c) {
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t zeros = 0;
+    for (size_t q = 0; q != 4; ++q) {
+      const auto *v = reinterpret_cast<const __m128i *>(c + 16 * q);
+      __m128i packed = _mm_packs_epi16(_mm_cmpeq_epi16(_mm_loadu_si128(v), zero),
+                                       _mm_cmpeq_epi16(_mm_loadu_si128(v + 1), zero));
+      zeros |= static_cast<uint64_t>(_mm_movemask_epi8(packed)) << (16 * q);
+    }
+    return ~zeros;
+  }
+
+  static uint64_t nonZeroMask(const uint32_t *c) {
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t zeros = 0;
+    for (size_t q = 0; q != 4; ++q) {
+      const auto *v = reinterpret_cast<const __m128i *>(c + 16 * q);
+      __m128i low = _mm_packs_epi32(_mm_cmpeq_epi32(_mm_loadu_si128(v), zero),
+                                    _mm_cmpeq_epi32(_mm_loadu_si128(v + 1), zero));
+      __m128i high = _mm_packs_epi32(_mm_cmpeq_epi32(_mm_loadu_si128(v + 2), zero),
+                                     _mm_cmpeq_epi32(_mm_loadu_si128(v + 3), zero));
+      zeros |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_packs_epi16(low, high))) << (16 * q);
+    }
+    return ~zeros;
+  }
+#else
+  template <typename T>
+  static uint64_t nonZeroMask(const T *c) {
+    uint8_t flags[BLOCK];
+    for (size_t k = 0; k != BLOCK; ++k) flags[k] = c[k] != 0;
+    uint64_t mask = 0;
+    for (size_t w = 0; w != BLOCK / 8; ++w) {
+      uint64_t word = 0;
+      for (size_t k = 0; k != 8; ++k) word |= static_cast<uint64_t>(flags[8 * w + k]) << (8 * k);
+      // byte k of word lands on bit 56 + k
+      mask |= ((word * 0x0102040810204080ull) >> 56) << (8 * w);
+    }
+    return mask;
+  }
+#endif
+
+  /*
+   * Codes the non-zero counters of line c at position at plus the set bits of mask; next is
+   * the first counter of the line not coded yet
+  */
+  template <typename T>
+  static uint8_t *putCounters(const T *c, size_t at, uint64_t mask, size_t &next, T &last,
+                              uint8_t *o) {
+    for (; mask != 0; mask &= mask - 1) {
+      size_t i = at + lowestBit(mask);
+      auto gap = static_cast<uint64_t>(i - next);
+      next = i + 1;
+      if (c[i] == last) {
+        o = putVarint(2 * gap, o);
+      } else {
+        int64_t delta = static_cast<int64_t>(c[i]) - static_cast<int64_t>(last);
+        auto zigzag = (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+        o = putVarint(zigzag - 1, putVarint(2 * gap + 1, o));
+        last = c[i];
+      }
+    }
+    return o;
+  }
+
+  // index of the lowest set bit of a non-zero mask
+  static unsigned lowestBit(uint64_t mask) {
+#if defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_ctzll(mask));
+#else
+    unsigned i = 0;
+    while ((mask & 1) == 0) {
+      mask >>= 1;
+      ++i;
+    }
+    return i;
+#endif
+  }
+
+  /*
+   * Writes varint v; values below 2^14, all but the longest gaps, take one or two bytes
+   * without a branch on their length, the second byte may be garbage past the varint
+  */
+  static uint8_t *putVarint(uint64_t v, uint8_t *out) {
+    if (v < 0x4000) {
+      auto two = static_cast<unsigned>(v >= 0x80);
+      out[0] = static_cast<uint8_t>(v | (two << 7));
+      out[1] = static_cast<uint8_t>(v >> 7);
+      return out + 1 + two;
+    }
+    for (; v >= 0x80; v >>= 7) *out++ = static_cast<uint8_t>(v | 0x80);
+    *out++ = static_cast<uint8_t>(v);
+    return out;
+  }
+
+  static bool getVarint(const uint8_t *&in, const uint8_t *end, uint64_t &v) {
+    v = 0;
+    for (unsigned shift = 0; in != end && shift < 64; shift += 7) {
+      uint8_t b = *in++;
+      v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if (b < 0x80) return true;
+    }
+    return false;
+  }
+
+  /*
+   * Writes the counter after gap zeros, which differs from last by zigzag code zigzag,
+   * 0 for none; zeros up to the end of the line without a difference end it
+  */
+  template <typename T>
+  static bool put(uint64_t gap, uint64_t zigzag, T &last, T *&c, T *end) {
+    if (gap >= static_cast<uint64_t>(end - c)) {
+      if (gap != static_cast<uint64_t>(end - c) || zigzag != 0) return false;
+      c = end;
+      return true;
+    }
+    c += gap;
+    if (zigzag != 0) {
+      int64_t delta = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+      int64_t value = static_cast<int64_t>(last) + delta;
+      if (value <= 0 || value > static_cast<int64_t>(std::numeric_limits<T>::max())) return false;
+      last = static_cast<T>(value);
+    }
+    *c++ = last;
+    return last != 0;
+  }
+};
+
+#endif // SPACE_CODEC_H
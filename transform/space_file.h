@@ -0,0 +1,380 @@
+#ifndef SPACE_FILE_H
+#define SPACE_FILE_H
+
+#include "hough_transform.h"
+#include "space_codec.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#ifdef ACCUMULATOR_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Header of a saved space, followed by the theta cells of a space restricted to some of them
+ * and, from dataOffset, by the raw buffer of its counters. Fields are in the byte order of
+ * the host that wrote them, byteOrder tells a reader of another order apart
+ * @field rStep, thetaStep - bytes of the steps as R_T and THETA_T
+ * @field rOffset, rSize, thetaSize - r cell of the first row, rows and columns without the
+ *  two extra ones
+ * @field thetaCells - amount of theta cells after the header, 0 for the full theta grid
+ * @field width, layout - bytes per counter and Layout of the buffer
+ * @field encoding - SpaceEncoding of the counters
+ * @field maxCount - the largest count
+ * @field dataOffset, dataBytes - position and size of the counters as encoded, dataOffset is
+ *  a multiple of SpaceFile::DATA_ALIGNMENT
+*/
+struct SpaceFileHeader {
+  char magic[8];
+  uint32_t version, byteOrder;
+  uint32_t rBytes, thetaBytes;
+  unsigned char rStep[16], thetaStep[16];
+  uint64_t rOffset, rSize, thetaSize, thetaCells;
+  uint32_t width, layout, encoding, reserved;
+  uint64_t maxCount, dataOffset, dataBytes;
+};
+
+static_assert(sizeof(SpaceFileHeader) == 128, "SpaceFileHeader must not be padded");
+
+/*
+ * How counters are stored in a space file. Raw is the buffer as it is in memory, so it can
+ * be mapped; Compressed is the code of SpaceCodec in lines of the layout (rows of a row-major
+ * buffer, columns of a column-major one, blocks of a tiled one), which is read and decoded
+ * into memory. It pays off for sparse spaces, e.g. a few points over a fine grid, whose
+ * code is a small part of the raw size. Coding costs a pass over the counters plus some
+ * nanoseconds per non-zero one, which is more than a copy of the raw counters once a few
+ * percent of them are non-zero, so counters whose code would exceed a byte per 32 of
+ * them are saved raw, and encoding stops there
+*/
+enum class SpaceEncoding { Raw, Compressed };
+
+/*
+ * Binary files of Hough spaces, to pass accumulators between stages and processes.
+ * save writes the header and the counters as they are in memory; load reads them back into
+ * memory, open maps them from the file without reading: counters are paged in as getLines
+ * or get reach them, and votes into an opened space are copied to memory and never change
+ * the file. A loaded or opened space gives the get, getLines and isOnLine of the saved one.
+ * Counters may be compressed, see SpaceEncoding, then open loads them.
+ * Sparse spaces are saved as compressed row-major counters whatever the encoding, coded a
+ * row at a time from their hit cells, so that saving takes memory for the hits and a row and
+ * not for the grid, which may be far larger than memory; loading one builds the dense grid,
+ * and fails for a grid that does not fit. Spaces over a non-uniform theta grid are not
+ * supported
+*/
+template <typename R_T, typename THETA_T>
+struct SpaceFile {
+private:
+  using space_t = HoughSpace<R_T, THETA_T>;
+public:
+  static const uint32_t VERSION = 2;
+  // files of version 1 have a shorter header without encoding and raw counters; they are read
+  static const uint32_t RAW_VERSION = 1;
+  // alignment of the counters in the file, a page so that they map without a skew
+  static const uint64_t DATA_ALIGNMENT = 4096;
+
+  /*
+   * @return false if the space is over a non-uniform grid, the file can not be written or
+   *  the hit cells of a sparse space do not fit in memory
+  */
+  static bool save(const space_t &space, const std::string &path,
+                   SpaceEncoding encoding = SpaceEncoding::Raw) {
+    if (!space.thetaSamples.empty()) return false;
+    static_assert(sizeof(R_T) <= 16 && sizeof(THETA_T) <= 16, "steps must fit the header");
+    std::vector<uint64_t> cells;
+    if (!space.thetaColumn.empty()) {
+      cells.resize(space.thetaSize);
+      for (size_t c = 0; c != space.thetaColumn.size(); ++c) {
+        if (space.thetaColumn[c] < space.thetaSize) cells[space.thetaColumn[c]] = c;
+      }
+    }
+    SpaceFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.rBytes = sizeof(R_T);
+    header.thetaBytes = sizeof(THETA_T);
+    std::memcpy(header.rStep, &space.rStep, sizeof(R_T));
+    std::memcpy(header.thetaStep, &space.thetaStep, sizeof(THETA_T));
+    header.rOffset = space.rOffset;
+    header.rSize = space.rSize;
+    header.thetaSize = space.thetaSize;
+    header.thetaCells = cells.size();
+    space.forEachCount([&header](size_t, size_t, uint32_t c) {
+      header.maxCount = std::max<uint64_t>(header.maxCount, c);
+    });
+    const Accumulator &counters = space.space;
+    header.width = space.sparse ? Accumulator::widthFor(header.maxCount) : counters.width;
+    header.layout = static_cast<uint32_t>(space.sparse ? Layout::RowMajor : counters.layout);
+    uint64_t end = sizeof(header) + cells.size() * sizeof(uint64_t);
+    header.dataOffset = (end + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+    const unsigned char *data = counters.template data<unsigned char>();
+    header.dataBytes = counters.bytes();
+    std::vector<uint8_t> code;
+    if (space.sparse) {
+      try {
+        switch (header.width) {
+          case 1: encodeSparse<uint8_t>(space, code); break;
+          case 2: encodeSparse<uint16_t>(space, code); break;
+          default: encodeSparse<uint32_t>(space, code);
+        }
+      } catch (const std::bad_alloc &) {
+        return false;
+      }
+      data = code.data();
+      header.dataBytes = code.size();
+      header.encoding = static_cast<uint32_t>(SpaceEncoding::Compressed);
+    } else if (encoding == SpaceEncoding::Compressed) {
+      size_t n = counters.bytes() / counters.width, line = lineOf(header);
+      size_t maxBytes = n / CODE_COUNTERS;
+      bool small;
+      switch (counters.width) {
+        case 1:
+          small = SpaceCodec::encode(counters.template data<uint8_t>(), n, line, code, maxBytes);
+          break;
+        case 2:
+          small = SpaceCodec::encode(counters.template data<uint16_t>(), n, line, code, maxBytes);
+          break;
+        default:
+          small = SpaceCodec::encode(counters.template data<uint32_t>(), n, line, code, maxBytes);
+      }
+      if (small) {
+        data = code.data();
+        header.dataBytes = code.size();
+        header.encoding = static_cast<uint32_t>(SpaceEncoding::Compressed);
+      }
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(cells.data()), cells.size() * sizeof(uint64_t));
+    std::vector<char> padding(header.dataOffset - end, 0);
+    out.write(padding.data(), padding.size());
+    out.write(reinterpret_cast<const char *>(data), header.dataBytes);
+    out.close();
+    return !out.fail();
+  }
+
+  /*
+   * Reads the space saved at path into memory
+   * @return false if the file is missing, truncated or not a space of R_T and THETA_T,
+   *  space is left unchanged then
+  */
+  static bool load(const std::string &path, std::unique_ptr<space_t> &space) {
+    SpaceFileHeader header;
+    std::vector<size_t> cells;
+    if (!readHeader(path, header, cells)) return false;
+    std::ifstream in(path, std::ios::binary);
+    in.seekg(static_cast<std::streamoff>(header.dataOffset));
+    SpaceFormat format;
+    format.layout = static_cast<Layout>(header.layout);
+    format.width = header.width;
+    std::unique_ptr<space_t> loaded;
+    std::vector<uint8_t> code;
+    try {
+      loaded = make(header, cells, format);
+      if (header.encoding == static_cast<uint32_t>(SpaceEncoding::Compressed)) {
+        code.resize(header.dataBytes);
+      }
+    } catch (const std::bad_alloc &) {
+      return false;
+    }
+    Accumulator &counters = loaded->space;
+    if (header.encoding == static_cast<uint32_t>(SpaceEncoding::Raw)) {
+      in.read(reinterpret_cast<char *>(counters.template data<unsigned char>()),
+              static_cast<std::streamsize>(header.dataBytes));
+      if (!in) return false;
+      space = std::move(loaded);
+      return true;
+    }
+    in.read(reinterpret_cast<char *>(code.data()), static_cast<std::streamsize>(code.size()));
+    if (!in) return false;
+    size_t n = counters.bytes() / counters.width, line = lineOf(header);
+    bool ok;
+    switch (counters.width) {
+      case 1: ok = SpaceCodec::decode(code.data(), code.size(), counters.template data<uint8_t>(),
+                                      n, line); break;
+      case 2: ok = SpaceCodec::decode(code.data(), code.size(), counters.template data<uint16_t>(),
+                                      n, line); break;
+      default: ok = SpaceCodec::decode(code.data(), code.size(),
+                                       counters.template data<uint32_t>(), n, line);
+    }
+    if (!ok) return false;
+    space = std::move(loaded);
+    return true;
+  }
+
+  /*
+   * Maps the counters of the space saved at path without reading them. The file may be
+   * removed or replaced while the space lives, but not truncated or written in place.
+   * Encoded counters are loaded
+   * @return false as load, or if the file can not be mapped
+  */
+  static bool open(const std::string &path, std::unique_ptr<space_t> &space) {
+#ifdef ACCUMULATOR_MMAP
+    SpaceFileHeader header;
+    std::vector<size_t> cells;
+    if (!readHeader(path, header, cells)) return false;
+    if (header.encoding != static_cast<uint32_t>(SpaceEncoding::Raw)) return load(path, space);
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) return false;
+    SpaceFormat format;
+    format.layout = static_cast<Layout>(header.layout);
+    format.width = header.width;
+    format.backing.file = file;
+    format.backing.offset = header.dataOffset;
+    format.backing.shared = false;
+    std::unique_ptr<space_t> opened;
+    try {
+      opened = make(header, cells, format);
+    } catch (const std::bad_alloc &) {
+      close(file);
+      return false;
+    }
+    // the mapping outlives the descriptor
+    close(file);
+    space = std::move(opened);
+    return true;
+#else
+    (void) path;
+    (void) space;
+    return false;
+#endif
+  }
+
+private:
+  static const char MAGIC[8];
+  static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+  // compressed counters are kept only when their code takes at most a byte per this many
+  // counters, about a non-zero counter in 32, below which decoding them beats a copy
+  static const uint64_t CODE_COUNTERS = 32;
+  // bytes of the header of RAW_VERSION, which ends with maxCount, dataOffset and dataBytes
+  // right after layout
+  static const uint64_t RAW_HEADER_BYTES = 120;
+
+  /*
+   * Reads and checks the header and theta cells of the file at path, the counters must be
+   * in the file whole and of the size of the geometry of the header
+  */
+  static bool readHeader(const std::string &path, SpaceFileHeader &header,
+                         std::vector<size_t> &cells) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) return false;
+    auto fileBytes = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header))) return false;
+    uint64_t headerBytes = sizeof(header);
+    if (header.version == RAW_VERSION) {
+      // the last three fields follow layout, where encoding and reserved are now
+      std::memmove(&header.maxCount, &header.encoding, 3 * sizeof(uint64_t));
+      header.encoding = static_cast<uint32_t>(SpaceEncoding::Raw);
+      header.reserved = 0;
+      headerBytes = RAW_HEADER_BYTES;
+      in.seekg(static_cast<std::streamoff>(headerBytes));
+    }
+    if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 ||
+        (header.version != VERSION && header.version != RAW_VERSION) ||
+        header.byteOrder != BYTE_ORDER_MARK ||
+        header.rBytes != sizeof(R_T) || header.thetaBytes != sizeof(THETA_T) ||
+        (header.width != 1 && header.width != 2 && header.width != 4) ||
+        header.layout > static_cast<uint32_t>(Layout::Tiled) ||
+        header.encoding > static_cast<uint32_t>(SpaceEncoding::Compressed) ||
+        header.rSize > std::numeric_limits<uint32_t>::max() - 2 ||
+        header.thetaSize > std::numeric_limits<uint32_t>::max() - 2 ||
+        (header.thetaCells != 0 && header.thetaCells != header.thetaSize) ||
+        header.maxCount > Accumulator::maxCount(header.width) ||
+        header.dataOffset % DATA_ALIGNMENT != 0 || header.dataOffset > fileBytes ||
+        header.dataBytes > fileBytes - header.dataOffset) return false;
+    size_t bytes = Accumulator::bytesOf(header.rSize + 2, header.thetaSize + 2,
+                                        static_cast<Layout>(header.layout), header.width);
+    bool raw = header.encoding == static_cast<uint32_t>(SpaceEncoding::Raw);
+    if ((raw && header.dataBytes != bytes) ||
+        header.dataOffset < headerBytes ||
+        header.thetaCells * sizeof(uint64_t) > header.dataOffset - headerBytes) return false;
+    std::vector<uint64_t> stored(header.thetaCells);
+    in.read(reinterpret_cast<char *>(stored.data()), stored.size() * sizeof(uint64_t));
+    if (!in) return false;
+    // cells of a region are increasing, which bounds the lookup table of their columns
+    for (size_t i = 0; i != stored.size(); ++i) {
+      if ((i != 0 && stored[i] <= stored[i - 1]) ||
+          stored[i] > std::numeric_limits<uint32_t>::max()) return false;
+    }
+    cells.assign(stored.begin(), stored.end());
+    return true;
+  }
+
+  /*
+   * Appends the code of the row-major counters of the grid of a sparse space, encoded a row
+   * at a time from its sorted cells, so that the grid itself is never in memory: memory
+   * follows the hit cells and a row. Rows without a hit share the code of an empty row
+  */
+  template <typename T>
+  static void encodeSparse(const space_t &space, std::vector<uint8_t> &code) {
+    std::vector<std::pair<uint64_t, uint32_t>> hits;
+    hits.reserve(space.hashed.size());
+    space.hashed.forEach([&hits](uint64_t key, uint32_t c) {
+      if (c != 0) hits.emplace_back(key, c);
+    });
+    std::sort(hits.begin(), hits.end());
+    std::vector<T> row(space.columns, 0);
+    std::vector<uint8_t> empty;
+    SpaceCodec::encode(row.data(), row.size(), row.size(), empty);
+    size_t k = 0;
+    for (size_t r = 0; r != space.rows; ++r) {
+      size_t first = k;
+      for (; k != hits.size() && hits[k].first / space.columns == r; ++k) {
+        row[hits[k].first % space.columns] = static_cast<T>(hits[k].second);
+      }
+      if (k == first) {
+        code.insert(code.end(), empty.begin(), empty.end());
+        continue;
+      }
+      SpaceCodec::encode(row.data(), row.size(), row.size(), code);
+      for (size_t j = first; j != k; ++j) row[hits[j].first % space.columns] = 0;
+    }
+  }
+
+  // counters of a line of the code of SpaceCodec
+  static size_t lineOf(const SpaceFileHeader &header) {
+    switch (static_cast<Layout>(header.layout)) {
+      case Layout::RowMajor: return header.thetaSize + 2;
+      case Layout::ColumnMajor: return header.rSize + 2;
+      default: return Accumulator::TILE * Accumulator::TILE;
+    }
+  }
+
+  static std::unique_ptr<space_t> make(const SpaceFileHeader &header,
+                                       const std::vector<size_t> &cells,
+                                       const SpaceFormat &format) {
+    R_T rStep;
+    THETA_T thetaStep;
+    std::memcpy(&rStep, header.rStep, sizeof(R_T));
+    std::memcpy(&thetaStep, header.thetaStep, sizeof(THETA_T));
+    std::unique_ptr<space_t> space;
+    if (header.thetaCells == 0) {
+      space.reset(new space_t(rStep, thetaStep, static_cast<uint32_t>(header.rSize),
+                              static_cast<uint32_t>(header.thetaSize), format));
+    } else {
+      space.reset(new space_t(rStep, thetaStep, header.rOffset, header.rSize, cells, format));
+    }
+    // the full grid starts from r cell 0 when it is built, a saved one need not
+    space->rOffset = header.rOffset;
+    R_T rStep2 = rStep / static_cast<R_T>(2);
+    for (size_t i = 0; i < space->rSize; ++i) {
+      space->rHead[i] = (header.rOffset + i) * rStep + rStep2;
+    }
+    space->bound = header.maxCount;
+    return space;
+  }
+};
+
+template <typename R_T, typename THETA_T>
+const char SpaceFile<R_T, THETA_T>::MAGIC[8] = {'H', 'O', 'U', 'G', 'H', 'S', 'P', 'C'};
+
+#endif // SPACE_FILE_H
@@ -0,0 +1,97 @@
+#ifndef SPACE_FILLING_CURVE_H
+#define SPACE_FILLING_CURVE_H
+
+#include "utils.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <stdint.h>
+
+/*
+ * Order in which points are voted. Points that are close along a space-filling curve are
+ * close on the plane, so their sinusoids hit neighbouring r cells of every column and
+ * consecutive votes reuse cache lines of the accumulator.
+*/
+enum class PointOrder { Input, Morton, Hilbert };
+
+/*
+ * Morton (Z-order) code of a cell of 2^16 x 2^16 grid: bits of x and y interleaved
+*/
+inline uint32_t mortonCode(uint32_t x, uint32_t y) {
+  auto spread = [](uint32_t v) {
+    v &= 0xffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+  };
+  return spread(x) | (spread(y) << 1);
+}
+
+/*
+ * Distance of a cell of 2^16 x 2^16 grid along the Hilbert curve
+*/
+inline uint32_t hilbertCode(uint32_t x, uint32_t y) {
+  uint32_t d = 0;
+  for (uint32_t s = 1u << 15; s > 0; s >>= 1) {
+    uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+    if (ry == 0) {
+      if (rx == 1) {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+/*
+ * Indices of points sorted along the curve, points are quantized to 2^16 x 2^16 grid
+ * over their bounding box. The indices and the keys of the sort come from allocator
+*/
+template <typename T, typename A = std::allocator<size_t>>
+std::vector<size_t, A> curveOrder(const std::vector<Point<T>> &points, PointOrder order,
+                                  const A &allocator = A()) {
+  using traits = std::allocator_traits<A>;
+  std::vector<size_t, A> indices(points.size(), 0, allocator);
+  for (size_t i = 0; i != indices.size(); ++i) indices[i] = i;
+  if (order == PointOrder::Input || points.empty()) return indices;
+  T minX = points[0].x, maxX = points[0].x, minY = points[0].y, maxY = points[0].y;
+  for (const auto &p : points) {
+    minX = std::min(minX, p.x);
+    maxX = std::max(maxX, p.x);
+    minY = std::min(minY, p.y);
+    maxY = std::max(maxY, p.y);
+  }
+  T scaleX = maxX > minX ? static_cast<T>(65535) / (maxX - minX) : 0;
+  T scaleY = maxY > minY ? static_cast<T>(65535) / (maxY - minY) : 0;
+  auto codeOf = [&](const Point<T> &p) {
+    auto x = static_cast<uint32_t>((p.x - minX) * scaleX);
+    auto y = static_cast<uint32_t>((p.y - minY) * scaleY);
+    return order == PointOrder::Morton ? mortonCode(x, y) : hilbertCode(x, y);
+  };
+  if (static_cast<uint64_t>(points.size()) > 0xffffffffull) {
+    // indices do not fit in the low half of a key, (code, index) pairs are sorted instead
+    using pair_t = std::pair<uint32_t, size_t>;
+    std::vector<pair_t, typename traits::template rebind_alloc<pair_t>> pairs(
+      points.size(), pair_t(), allocator);
+    for (size_t i = 0; i != points.size(); ++i) pairs[i] = std::make_pair(codeOf(points[i]), i);
+    std::sort(pairs.begin(), pairs.end());
+    for (size_t i = 0; i != pairs.size(); ++i) indices[i] = pairs[i].second;
+    return indices;
+  }
+  std::vector<uint64_t, typename traits::template rebind_alloc<uint64_t>> keys(
+    points.size(), 0, allocator);
+  for (size_t i = 0; i != points.size(); ++i) {
+    keys[i] = (static_cast<uint64_t>(codeOf(points[i])) << 32) | i;
+  }
+  std::sort(keys.begin(), keys.end());
+  for (size_t i = 0; i != keys.size(); ++i) indices[i] = static_cast<size_t>(keys[i] & 0xffffffff);
+  return indices;
+}
+
+#endif // SPACE_FILLING_CURVE_H
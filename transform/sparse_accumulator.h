@@ -0,0 +1,130 @@
+#ifndef SPARSE_ACCUMULATOR_H
+#define SPARSE_ACCUMULATOR_H
+
+#include "memory_resource.h"
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Counters of an accumulator whose cells are mostly empty: open addressing hash map from
+ * cell index to count. Keys and counts share one array of slots and collisions probe the
+ * next slots linearly, so a lookup usually stays within one cache line. Capacity is a power
+ * of two, the load is kept below one half. Slots come from a memory resource.
+*/
+struct SparseAccumulator {
+  explicit SparseAccumulator(MemoryResource *resource = heapResource()) :
+    slots(ResourceAllocator<Slot>(resource)), shift(64), used(0) {}
+
+  uint32_t get(uint64_t key) const {
+    if (slots.empty()) return 0;
+    size_t mask = slots.size() - 1;
+    for (size_t i = slotOf(key); ; i = (i + 1) & mask) {
+      if (slots[i].key == key) return slots[i].count;
+      if (slots[i].key == EMPTY) return 0;
+    }
+  }
+
+  /*
+   * Counter of key, inserted as zero when missing. The reference is valid until the next insert
+  */
+  uint32_t &at(uint64_t key) {
+    reserve(used + 1);
+    return slots[find(key, slotOf(key))].count;
+  }
+
+  void add(uint64_t key, uint32_t weight) { at(key) += weight; }
+
+  /*
+   * Adds weight to n keys. Home slots of a block of keys are hashed and prefetched first,
+   * so the probes of the block overlap their cache misses instead of waiting for each one
+  */
+  void addBatch(const uint64_t *keys, size_t n, uint32_t weight) {
+    const size_t BLOCK = 32;
+    reserve(used + n);
+    size_t home[BLOCK];
+    for (size_t b = 0; b < n; b += BLOCK) {
+      size_t m = std::min(BLOCK, n - b);
+      for (size_t k = 0; k != m; ++k) {
+        home[k] = slotOf(keys[b + k]);
+#if defined(__GNUC__)
+        __builtin_prefetch(&slots[home[k]], 1);
+#endif
+      }
+      for (size_t k = 0; k != m; ++k) slots[find(keys[b + k], home[k])].count += weight;
+    }
+  }
+
+  /*
+   * Makes room for expected keys without rehashing
+  */
+  void reserve(size_t expected) {
+    if (2 * expected < slots.size()) return;
+    size_t capacity = std::max<size_t>(slots.size(), 1024);
+    while (capacity <= 2 * expected) capacity <<= 1;
+    rehash(capacity);
+  }
+
+  void clear() {
+    std::fill(slots.begin(), slots.end(), Slot());
+    used = 0;
+  }
+
+  // amount of stored keys
+  size_t size() const { return used; }
+
+  /*
+   * Calls f(key, count) for every stored key, in no particular order
+  */
+  template <typename F>
+  void forEach(F f) const {
+    for (const auto &s : slots) {
+      if (s.key != EMPTY) f(s.key, s.count);
+    }
+  }
+
+private:
+  static const uint64_t EMPTY = ~static_cast<uint64_t>(0);
+
+  struct Slot {
+    uint64_t key;
+    uint32_t count;
+    Slot() : key(EMPTY), count(0) {}
+  };
+
+  // Fibonacci hashing: top bits of the key times 2^64 / golden ratio
+  size_t slotOf(uint64_t key) const {
+    return shift == 64 ? 0 : static_cast<size_t>((key * 0x9e3779b97f4a7c15ull) >> shift);
+  }
+
+  size_t find(uint64_t key, size_t i) {
+    size_t mask = slots.size() - 1;
+    for (; ; i = (i + 1) & mask) {
+      if (slots[i].key == key) return i;
+      if (slots[i].key == EMPTY) {
+        slots[i].key = key;
+        ++used;
+        return i;
+      }
+    }
+  }
+
+  void rehash(size_t capacity) {
+    ResourceVector<Slot> old(capacity, Slot(), slots.get_allocator());
+    old.swap(slots);
+    shift = 64;
+    for (size_t c = capacity; c > 1; c >>= 1) --shift;
+    used = 0;
+    for (const auto &s : old) {
+      if (s.key != EMPTY) slots[find(s.key, slotOf(s.key))].count = s.count;
+    }
+  }
+
+  ResourceVector<Slot> slots;
+  unsigned shift;
+  size_t used;
+};
+
+#endif // SPARSE_ACCUMULATOR_H
@@ -0,0 +1,217 @@
+#ifndef STATIC_HOUGH_TRANSFORM_H
+#define STATIC_HOUGH_TRANSFORM_H
+
+#include "utils.h"
+#include <array>
+#include <memory>
+#include <vector>
+#include <set>
+#include <cmath>
+
+/*
+ * Compile-time trigonometry: Taylor series after reduction to [-pi, pi],
+ * thirty terms keep double precision on the whole range
+*/
+constexpr double STATIC_PI = 3.14159265358979323846;
+
+constexpr double ctReduce(double x) {
+  return x > STATIC_PI ? ctReduce(x - 2 * STATIC_PI)
+                       : (x < -STATIC_PI ? ctReduce(x + 2 * STATIC_PI) : x);
+}
+
+constexpr double ctSeries(double x2, double term, double sum, int k, int first) {
+  return k > 30 ? sum : ctSeries(x2, -term * x2 / ((2 * k + first - 1) * (2 * k + first)),
+                                 sum + term, k + 1, first);
+}
+
+constexpr double ctSin(double x) {
+  return ctSeries(ctReduce(x) * ctReduce(x), ctReduce(x), 0, 1, 1);
+}
+
+constexpr double ctCos(double x) {
+  return ctSeries(ctReduce(x) * ctReduce(x), 1, 0, 1, 0);
+}
+
+template <size_t... I>
+struct index_list {
+  using type = index_list;
+};
+
+template <typename A, typename B>
+struct concat_indices;
+
+template <size_t... A, size_t... B>
+struct concat_indices<index_list<A...>, index_list<B...>>
+  : index_list<A..., (sizeof...(A) + B)...> {};
+
+// logarithmic depth, so grids of thousands of cells stay below the template depth limit
+template <size_t N>
+struct make_index_list : concat_indices<typename make_index_list<N / 2>::type,
+                                        typename make_index_list<N - N / 2>::type> {};
+
+template <>
+struct make_index_list<0> : index_list<> {};
+
+template <>
+struct make_index_list<1> : index_list<0> {};
+
+/*
+ * Transformer and space with grid fixed at compile time: THETA_CELLS columns over [0, 2 * pi)
+ * and R_CELLS rows over [0, R_EXTENT). The accumulator is a std::array, the trigonometry
+ * tables are constexpr and all loops have constant trip counts, so voting compiles to
+ * fixed-length vector code without any setup at run time.
+ * E.g. 0.5 degree steps over 2048 px frame: StaticHoughTransformer2d<float, 720, 2897, 2897>.
+ * Points farther than R_EXTENT from the origin are not voted.
+*/
+template <typename T, size_t THETA_CELLS, size_t R_CELLS, size_t R_EXTENT>
+struct StaticHoughTransformer2d {
+  static constexpr T rStep = static_cast<T>(R_EXTENT) / static_cast<T>(R_CELLS);
+  static constexpr T thetaStep = static_cast<T>(2 * STATIC_PI / THETA_CELLS);
+  // theta columns are voted in blocks of this size
+  static constexpr size_t BLOCK = 8;
+
+  using row_t = std::array<uint32_t, THETA_CELLS>;
+  using space_t = std::array<row_t, R_CELLS>;
+
+  struct Space {
+    uint32_t get(T r, T theta) const {
+      size_t row = rowOf(r), column = columnOf(theta);
+      if (row >= R_CELLS) return 0;
+      return (*space)[row][column];
+    }
+
+    const space_t &getSpace() const { return *space; }
+
+    std::vector<Line<T, T>> getLines(uint32_t amount) const {
+      std::multiset<Node> lines;
+      for (size_t rt = 0; rt < R_CELLS; ++rt) {
+        for (size_t thetat = 0; thetat < THETA_CELLS; ++thetat) {
+          uint32_t count = (*space)[rt][thetat];
+          if (count > 1) lines.emplace(count, Line<T, T>(rHead(rt), thetaHead(thetat)));
+        }
+      }
+      std::vector<Line<T, T>> amountLines;
+      uint32_t cnt = 0;
+      for (auto it = lines.rbegin(); (it != lines.rend()) && (cnt != amount); ++it, ++cnt) {
+        amountLines.emplace_back(it->line);
+      }
+      return amountLines;
+    }
+
+    bool isOnLine(const Line<T, T> &line, const Point<T> &p) const {
+      size_t column = columnOf(line.theta);
+      T r = p.x * static_cast<T>(cosTable[column]) + p.y * static_cast<T>(sinTable[column]);
+      return (r >= 0) && (rowOf(r) == rowOf(line.r));
+    }
+
+    Space() : space(new space_t()) {}
+
+  private:
+    struct Node {
+      uint32_t count;
+      Line<T, T> line;
+      bool operator<(const Node &rhs) const { return count < rhs.count; }
+      Node(uint32_t count, Line<T, T> line) : count(count), line(line) {}
+    };
+
+    std::unique_ptr<space_t> space;
+
+    friend struct StaticHoughTransformer2d;
+  };
+
+  Space transform(const std::vector<Point<T>> &points) const {
+    Space result;
+    space_t &space = *result.space;
+    std::array<uint32_t, THETA_CELLS> rows;
+    for (const auto &p : points) {
+      binColumns(p.x, p.y, rows);
+      for (size_t i = 0; i != THETA_CELLS; ++i) {
+        if (rows[i] < R_CELLS) ++space[rows[i]][i];
+      }
+    }
+    return result;
+  }
+
+  static constexpr T rHead(size_t i) {
+    return (static_cast<T>(i) + static_cast<T>(0.5)) * rStep;
+  }
+  static constexpr T thetaHead(size_t i) {
+    return static_cast<T>((i + 0.5) * 2 * STATIC_PI / THETA_CELLS);
+  }
+
+private:
+
+  template <size_t... I>
+  static constexpr std::array<T, THETA_CELLS> cosTableOf(index_list<I...>) {
+    return {{static_cast<T>(ctCos((I + 0.5) * 2 * STATIC_PI / THETA_CELLS))...}};
+  }
+
+  template <size_t... I>
+  static constexpr std::array<T, THETA_CELLS> sinTableOf(index_list<I...>) {
+    return {{static_cast<T>(ctSin((I + 0.5) * 2 * STATIC_PI / THETA_CELLS))...}};
+  }
+
+public:
+  static constexpr std::array<T, THETA_CELLS> cosTable =
+    cosTableOf(typename make_index_list<THETA_CELLS>::type());
+  static constexpr std::array<T, THETA_CELLS> sinTable =
+    sinTableOf(typename make_index_list<THETA_CELLS>::type());
+
+private:
+
+  static size_t rowOf(T r) {
+    if (!(r >= 0)) return R_CELLS;
+    T q = r * (static_cast<T>(1) / rStep);
+    return q < static_cast<T>(R_CELLS) ? static_cast<size_t>(q) : R_CELLS;
+  }
+
+  static size_t columnOf(T theta) {
+    const T full = static_cast<T>(2 * STATIC_PI);
+    theta = std::fmod(theta, full);
+    if (theta < 0) theta += full;
+    auto column = static_cast<size_t>(theta / thetaStep);
+    return column < THETA_CELLS ? column : THETA_CELLS - 1;
+  }
+
+  /*
+   * Row of every column for point (x, y), R_CELLS when outside. Full blocks have a constant
+   * trip count and no branches, the compiler unrolls and vectorizes them.
+  */
+  static void binColumns(T x, T y, std::array<uint32_t, THETA_CELLS> &rows) {
+    const T inv = static_cast<T>(1) / rStep, limit = static_cast<T>(R_CELLS);
+    const size_t full = THETA_CELLS / BLOCK * BLOCK;
+    for (size_t b = 0; b < full; b += BLOCK) {
+      for (size_t k = 0; k < BLOCK; ++k) {
+        T r = x * cosTable[b + k] + y * sinTable[b + k];
+        T q = std::max(std::min(r * inv, limit), static_cast<T>(-1));
+        auto row = static_cast<uint32_t>(static_cast<int32_t>(q));
+        rows[b + k] = r >= 0 ? row : static_cast<uint32_t>(R_CELLS);
+      }
+    }
+    for (size_t i = full; i < THETA_CELLS; ++i) {
+      T r = x * cosTable[i] + y * sinTable[i];
+      T q = std::max(std::min(r * inv, limit), static_cast<T>(-1));
+      auto row = static_cast<uint32_t>(static_cast<int32_t>(q));
+      rows[i] = r >= 0 ? row : static_cast<uint32_t>(R_CELLS);
+    }
+  }
+};
+
+template <typename T, size_t THETA_CELLS, size_t R_CELLS, size_t R_EXTENT>
+constexpr T StaticHoughTransformer2d<T, THETA_CELLS, R_CELLS, R_EXTENT>::rStep;
+
+template <typename T, size_t THETA_CELLS, size_t R_CELLS, size_t R_EXTENT>
+constexpr T StaticHoughTransformer2d<T, THETA_CELLS, R_CELLS, R_EXTENT>::thetaStep;
+
+template <typename T, size_t THETA_CELLS, size_t R_CELLS, size_t R_EXTENT>
+constexpr size_t StaticHoughTransformer2d<T, THETA_CELLS, R_CELLS, R_EXTENT>::BLOCK;
+
+template <typename T, size_t THETA_CELLS, size_t R_CELLS, size_t R_EXTENT>
+constexpr std::array<T, THETA_CELLS>
+StaticHoughTransformer2d<T, THETA_CELLS, R_CELLS, R_EXTENT>::cosTable;
+
+template <typename T, size_t THETA_CELLS, size_t R_CELLS, size_t R_EXTENT>
+constexpr std::array<T, THETA_CELLS>
+StaticHoughTransformer2d<T, THETA_CELLS, R_CELLS, R_EXTENT>::sinTable;
+
+#endif // STATIC_HOUGH_TRANSFORM_H
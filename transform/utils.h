@@ -31,6 +31,18 @@ struct Line {
   Line(R_T r, THETA_T theta) : r(r), theta(theta) {}
 };
 
+/*
+ * Raster image stored row by row, pixel (x, y) corresponds to Point(x, y)
+*/
+template <typename T>
+struct Image {
+  const size_t width, height;
+  std::vector<T> pixels;
+  Image(size_t width, size_t height) : width(width), height(height), pixels(width * height) {}
+  T at(size_t x, size_t y) const { return pixels[y * width + x]; }
+  T &at(size_t x, size_t y) { return pixels[y * width + x]; }
+};
+
 /*
  * Function to get distance between (0, 0) and line
  * @param p - any point on line